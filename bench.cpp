@@ -0,0 +1,250 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	bench.cpp
+ * @brief	kd_search_array.hpp 関連の性能計測用コマンド
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "kd_search_array.hpp"
+#include "kd_forest.hpp"
+#include "kd_dual_tree.hpp"
+#include "kd_point_loader.hpp"
+
+#define	D	3
+
+typedef std::array<float, D>	Point;
+
+/**
+ * 経過時間の計測
+ * @return	基準時刻からの経過秒数
+ */
+static double
+Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * 点データの読み込みの計測
+ * @param[in]	points	点
+ */
+static void
+MeasureLoader(const std::vector<Point>& points)
+{
+	const char* binary = "benchmark_points.bin";
+	const char* csv = "benchmark_points.csv";
+
+	double sizes[2];	// 書き出したファイルの大きさ (読み直さずに済むように)
+
+	std::FILE* file = std::fopen(binary, "wb");
+	if (!file) return;
+	std::fwrite(points.data(), sizeof(Point), points.size(), file);
+	sizes[0] = (double)std::ftell(file);
+	std::fclose(file);
+
+	file = std::fopen(csv, "w");
+	if (!file) {
+		std::remove(binary);
+		return;
+	}
+	for (const auto& p : points) std::fprintf(file, "%g,%g,%g\n", p[0], p[1], p[2]);
+	sizes[1] = (double)std::ftell(file);
+	std::fclose(file);
+
+	const char* paths[2] = {binary, csv};
+	for (size_t i(0); i < 2; ++i) {
+		std::vector<Point> output;
+		double t = Now();
+		bool f = i == 0
+			? ys::KDPointLoader<float, D>::LoadBinary(paths[i], output)
+			: ys::KDPointLoader<float, D>::LoadCsv(paths[i], output);
+		t = Now() - t;
+
+		std::printf("loader %-6s: %s %lu points, %.3f GB/s\n",
+					i == 0 ? "binary" : "csv", f ? "ok" : "NG",
+					output.size(), sizes[i] / t / 1e9);
+		std::remove(paths[i]);
+	}
+}
+
+/**
+ * 近似近傍探索の再現率と毎秒の探索数の計測
+ * @param[in]	m	点の数
+ * @note	厳密解を正解として、@a epsilon と @a checks を変えた時の再現率 (recall@10) を出力する。
+ */
+template<size_t DIMENSION>
+static void
+MeasureNearest(size_t m)
+{
+	const size_t K = 10;
+	const size_t Q = 200;
+
+	std::mt19937 mt(2);
+	std::normal_distribution<float> u(0.0f, 1.0f);
+	std::vector<std::array<float, DIMENSION> > points(m), queries(Q);
+	for (auto& p : points) {
+		for (auto& x : p) x = u(mt);
+	}
+	for (auto& q : queries) {
+		for (auto& x : q) x = u(mt);
+	}
+
+	ys::KDSearchArray<float, DIMENSION> tree;
+	if (!tree.prepare(points.data(), m)) return;
+
+	std::vector<std::vector<size_t> > truth(Q);
+	std::vector<std::pair<double, size_t> > neighbors;
+	double t = Now();
+	for (size_t i(0); i < Q; ++i) {
+		tree.nearest(points.data(), queries[i], K, neighbors);
+		for (const auto& n : neighbors) truth[i].push_back(n.second);
+		std::sort(truth[i].begin(), truth[i].end());
+	}
+	t = Now() - t;
+	std::printf("nearest %2lud exact           : recall 1.000, %10.0f queries/s\n", DIMENSION, Q / t);
+
+	// 全探索 (比較用)
+	std::vector<std::pair<double, size_t> > all(m);
+	t = Now();
+	for (size_t i(0); i < Q; ++i) {
+		for (size_t j(0); j < m; ++j) {
+			double s(0.0);
+			for (size_t d(0); d < DIMENSION; ++d) s += ((double)points[j][d] - queries[i][d]) * ((double)points[j][d] - queries[i][d]);
+			all[j] = std::make_pair(s, j);
+		}
+		std::partial_sort(all.begin(), all.begin() + K, all.end());
+	}
+	t = Now() - t;
+	std::printf("nearest %2lud brute force     : recall 1.000, %10.0f queries/s\n", DIMENSION, Q / t);
+
+	const double epsilons[] = {0.0, 0.5, 1.0};
+	const size_t checks[] = {16, 64, 256, 1024, 4096};
+	for (double e : {0.5, 1.0, 2.0}) {
+		size_t h(0);
+		t = Now();
+		for (size_t i(0); i < Q; ++i) {
+			tree.nearest(points.data(), queries[i], K, neighbors, e);
+			for (const auto& n : neighbors) {
+				h += std::binary_search(truth[i].begin(), truth[i].end(), n.second) ? 1 : 0;
+			}
+		}
+		t = Now() - t;
+		std::printf("nearest %2lud eps %.1f            : recall %.3f, %10.0f queries/s\n",
+					DIMENSION, e, (double)h / (Q * K), Q / t);
+	}
+	for (double e : epsilons) {
+		for (size_t c : checks) {
+			size_t h(0);
+			t = Now();
+			for (size_t i(0); i < Q; ++i) {
+				tree.nearest(points.data(), queries[i], K, neighbors, e, c);
+				for (const auto& n : neighbors) {
+					h += std::binary_search(truth[i].begin(), truth[i].end(), n.second) ? 1 : 0;
+				}
+			}
+			t = Now() - t;
+			std::printf("nearest %2lud eps %.1f checks %4lu: recall %.3f, %10.0f queries/s\n",
+						DIMENSION, e, c, (double)h / (Q * K), Q / t);
+		}
+	}
+
+	ys::KDForest<float, DIMENSION> forest;
+	if (!forest.prepare(points.data(), m, 4)) return;
+	for (size_t c : checks) {
+		size_t h(0);
+		t = Now();
+		for (size_t i(0); i < Q; ++i) {
+			forest.nearest(queries[i], K, neighbors, 0.0, c);
+			for (const auto& n : neighbors) {
+				h += std::binary_search(truth[i].begin(), truth[i].end(), n.second) ? 1 : 0;
+			}
+		}
+		t = Now() - t;
+		std::printf("forest  %2lud x%lu    checks %4lu: recall %.3f, %10.0f queries/s\n",
+					DIMENSION, forest.trees(), c, (double)h / (Q * K), Q / t);
+	}
+}
+
+/**
+ * 全点の近傍探索 (dual-tree) の毎秒の探索数の計測
+ * @param[in]	points	点
+ * @note	スレッド数を1とハードウェアのスレッド数にした時の結果を出力する。
+ * @note	点の数は計測コマンドの第2引数で指定する (既定は1000万点)。
+ */
+static void
+MeasureAllNearest(const std::vector<Point>& points)
+{
+	const size_t K = 8;
+
+	ys::KDSearchArray<float, D> tree;
+	double t = Now();
+	if (!tree.prepare(points.data(), points.size())) return;
+	ys::KDDualTree<float, D> dual(tree, points.data());
+	if (!dual.prepare()) return;
+	t = Now() - t;
+	std::printf("all-nearest build        : %.3f s\n", t);
+
+	size_t threads[2] = {1, std::max(std::thread::hardware_concurrency(), 1U)};
+	std::vector<std::pair<double, size_t> > neighbors;
+	for (size_t i(0); i < 2; ++i) {
+		if (i == 1 && threads[1] == 1) break;
+		t = Now();
+		bool f = dual.all_nearest(K, neighbors, threads[i]);
+		t = Now() - t;
+		std::printf("all-nearest k=%lu %3lu thr : %s %10.0f queries/s\n",
+					K, threads[i], f ? "ok" : "NG", points.size() / t);
+	}
+}
+
+/**
+ * 一様乱数による点群の生成
+ * @param[in]	length	点の数
+ * @param[out]	points	点
+ */
+static void
+Generate(size_t length,
+		 std::vector<Point>& points)
+{
+	std::mt19937 mt(1);
+	std::uniform_real_distribution<float> u(0.0f, 1000.0f);
+	points.resize(length);
+	for (auto& p : points) {
+		for (auto& x : p) x = u(mt);
+	}
+}
+
+/**
+ * 計測コマンド
+ * @param[in]	argc	引数の数
+ * @param[in]	argv	引数 (第1引数は点の数、第2引数は全点の近傍探索の点の数)
+ * @note	例: ./benchmark 1000000 10000000
+ */
+int
+main(int argc,
+	 char* argv[])
+{
+	size_t m = 1 < argc ? (size_t)std::strtoul(argv[1], 0, 10) : 1000000;
+	size_t n = 2 < argc ? (size_t)std::strtoul(argv[2], 0, 10) : 10000000;
+
+	std::vector<Point> points;
+	Generate(m, points);
+
+	MeasureLoader(points);
+	MeasureNearest<16>(std::min(m, (size_t)200000));
+
+	if (n != m) {
+		std::vector<Point>().swap(points);
+		Generate(n, points);
+	}
+	MeasureAllNearest(points);
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_aggregate_array.hpp
+ * @brief	部分木ごとの集約値で範囲内の集計を行う配列版kD木
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_AGGREGATE_ARRAY_HPP__
+#define	__KD_AGGREGATE_ARRAY_HPP__	"kd_aggregate_array.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <limits>
+#include <memory>
+#include "kd_payload_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 点の数・総和・最小値・最大値の集約値 (モノイド)
+	 * @note	@a KDAggregateArray のモノイドの例。
+				モノイドは単位元 @a Identity と結合 @a Combine を静的メンバ関数として持つこと。
+	 */
+	template<typename T>
+	struct KDSummary
+	{
+		size_t count;	///< 点の数
+		T sum;			///< 総和
+		T min;			///< 最小値
+		T max;			///< 最大値
+
+		/**
+		 * 単位元の取得
+		 * @return	単位元
+		 */
+		static KDSummary<T>
+		Identity()
+			{
+				KDSummary<T> s;
+				s.count = 0;
+				s.sum = T();
+				s.min = std::numeric_limits<T>::max();
+				s.max = std::numeric_limits<T>::lowest();
+				return s;
+			}
+
+		/**
+		 * 1点の集約値の取得
+		 * @param[in]	value	点の値
+		 * @return	集約値
+		 */
+		static KDSummary<T>
+		Of(const T& value)
+			{
+				KDSummary<T> s;
+				s.count = 1;
+				s.sum = s.min = s.max = value;
+				return s;
+			}
+
+		/**
+		 * 集約値の結合
+		 * @param[in]	l	集約値
+		 * @param[in]	r	集約値
+		 * @return	結合した集約値
+		 */
+		static KDSummary<T>
+		Combine(const KDSummary<T>& l,
+				const KDSummary<T>& r)
+			{
+				KDSummary<T> s;
+				s.count = l.count + r.count;
+				s.sum = l.sum + r.sum;
+				s.min = r.min < l.min ? r.min : l.min;
+				s.max = l.max < r.max ? r.max : l.max;
+				return s;
+			}
+
+		/**
+		 * 平均値の取得
+		 * @return	平均値 (点が無ければ0)
+		 */
+		double
+		mean() const
+			{
+				return count ? (double)sum / count : 0.0;
+			}
+	};
+
+	/**
+	 * 部分木ごとの集約値で範囲内の集計を行う配列版kD木
+	 * @note	各点の値 @a MONOID から、部分木ごとの包含矩形と集約値を @a prepare で求めておく。
+				@a aggregate は範囲に完全に含まれる部分木の集約値をそのまま使い、
+				範囲の境界にかかる部分木だけを辿る。
+				点の削除・移動には対応しないので、変更後は @a prepare し直すこと。
+	 */
+	template<typename TYPE, size_t N, typename MONOID, typename ALLOCATOR = std::allocator<size_t> >
+	class KDAggregateArray
+	{
+	private:
+
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<std::array<TYPE, N> > PointAllocator;
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<MONOID> MonoidAllocator;
+
+		KDPayloadArray<TYPE, N, MONOID, ALLOCATOR> tree_;	///< 点の値を付加情報に持つkD木
+		std::vector<std::array<TYPE, N>, PointAllocator> lower_;	///< 各部分木の包含矩形の下限
+		std::vector<std::array<TYPE, N>, PointAllocator> upper_;	///< 各部分木の包含矩形の上限
+		std::vector<MONOID, MonoidAllocator> summaries_;	///< 各部分木の集約値
+
+		/**
+		 * 部分木の包含矩形と集約値の計算
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 */
+		void
+		summarize(size_t index)
+			{
+				const std::array<TYPE, N>& p = tree_.coordinate(0, index);
+				lower_[index] = upper_[index] = p;
+				summaries_[index] = tree_.payload(index);
+
+				for (size_t k(index * 2 + 1); k <= index * 2 + 2 && k < tree_.capacity(); ++k) {
+					if (tree_.at(k) == ~0LU) continue;
+					summarize(k);
+					for (size_t i(0); i < N; ++i) {
+						if (lower_[k][i] < lower_[index][i]) lower_[index][i] = lower_[k][i];
+						if (upper_[index][i] < upper_[k][i]) upper_[index][i] = upper_[k][i];
+					}
+					summaries_[index] = MONOID::Combine(summaries_[index], summaries_[k]);
+				}
+			}
+
+		/**
+		 * 部分木内の範囲内の点の集計
+		 * @param[in]	from	範囲の始点
+		 * @param[in]	to	範囲の終点
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	集約値
+		 */
+		MONOID
+		aggregate(const std::array<TYPE, N>& from,
+				  const std::array<TYPE, N>& to,
+				  size_t index) const
+			{
+				bool inside(true);
+				for (size_t i(0); i < N; ++i) {
+					if (upper_[index][i] < from[i] || to[i] < lower_[index][i]) return MONOID::Identity();
+					inside = inside && from[i] <= lower_[index][i] && upper_[index][i] <= to[i];
+				}
+				if (inside) return summaries_[index];
+
+				const std::array<TYPE, N>& p = tree_.coordinate(0, index);
+				bool f(true);
+				for (size_t i(0); i < N && f; ++i) {
+					f = (from[i] <= p[i]) & (p[i] <= to[i]);
+				}
+
+				MONOID s = f ? tree_.payload(index) : MONOID::Identity();
+				for (size_t k(index * 2 + 1); k <= index * 2 + 2 && k < tree_.capacity(); ++k) {
+					if (tree_.at(k) < ~0LU) s = MONOID::Combine(s, aggregate(from, to, k));
+				}
+
+				return s;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDAggregateArray()
+			: tree_(), lower_(), upper_(), summaries_()
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDAggregateArray(const KDAggregateArray<TYPE, N, MONOID, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDAggregateArray&
+		operator =(const KDAggregateArray<TYPE, N, MONOID, ALLOCATOR>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDAggregateArray()
+			{
+				;
+			}
+
+		/**
+		 * kD木と集約値の準備
+		 * @param[in]	values	データ (準備後は不要)
+		 * @param[in]	monoids	各点の値 (準備後は不要)
+		 * @param[in]	length	配列 @a values, @a monoids の要素数
+		 * @return	成功したら true
+		 */
+		bool
+		prepare(const std::array<TYPE, N>* values,
+				const MONOID* monoids,
+				size_t length)
+			{
+				if (!tree_.prepare(values, monoids, length)) return false;
+
+				try {
+					lower_.resize(tree_.capacity());
+					upper_.resize(tree_.capacity());
+					summaries_.assign(tree_.capacity(), MONOID::Identity());
+				}
+				catch (...) {
+					return false;
+				}
+
+				summarize(0);
+
+				return true;
+			}
+
+		/**
+		 * 範囲内の点の集計
+		 * @param[in]	from	範囲の始点
+		 * @param[in]	to	範囲の終点
+		 * @return	範囲内の点の値を結合した集約値 (点が無ければ単位元)
+		 */
+		MONOID
+		aggregate(const std::array<TYPE, N>& from,
+				  const std::array<TYPE, N>& to) const
+			{
+				assert(!summaries_.empty());
+
+				return aggregate(from, to, 0);
+			}
+
+		/**
+		 * kD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points) const
+			{
+				tree_.find(from, to, points);
+			}
+
+		/**
+		 * 点の数の取得
+		 * @return	点の数
+		 */
+		size_t
+		size() const
+			{
+				return tree_.size();
+			}
+	};
+};
+
+#endif	// __KD_AGGREGATE_ARRAY_HPP__
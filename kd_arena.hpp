@@ -0,0 +1,204 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_arena.hpp
+ * @brief	多数の小さな配列版kD木をまとめて確保するためのアリーナ
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_ARENA_HPP__
+#define	__KD_ARENA_HPP__	"kd_arena.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+namespace ys
+{
+	/**
+	 * 解放をまとめて行うアリーナ
+	 * @note	確保は大きなブロックを切り出すだけで、個別の解放は何もしない。
+				@a reset で全ての領域をまとめて再利用できるようにする。
+				スレッド・セーフではない。
+	 */
+	class KDArena
+	{
+	private:
+
+		std::vector<char*> blocks_;		///< 確保したブロック
+		std::vector<size_t> sizes_;		///< 各ブロックのバイト数
+		size_t block_size_;				///< 新しく確保するブロックの最小バイト数
+		size_t current_;				///< 切り出し中のブロック
+		size_t offset_;					///< 切り出し中のブロックの使用済みバイト数
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	block_size	1ブロックのバイト数
+		 */
+		explicit KDArena(size_t block_size = 1 << 20)
+			: blocks_(), sizes_(), block_size_(block_size), current_(0), offset_(0)
+			{
+				assert(0 < block_size);
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDArena(const KDArena&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDArena&
+		operator =(const KDArena&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDArena()
+			{
+				for (auto b : blocks_) ::operator delete(b);
+			}
+
+		/**
+		 * 領域の確保
+		 * @param[in]	size	バイト数
+		 * @param[in]	alignment	アラインメント
+		 * @return	確保した領域
+		 * @note	確保できなければ std::bad_alloc を投げる。
+		 */
+		void*
+		allocate(size_t size,
+				 size_t alignment)
+			{
+				assert(0 < alignment);
+
+				while (current_ < blocks_.size()) {
+					size_t o = (offset_ + alignment - 1) / alignment * alignment;
+					if (o + size <= sizes_[current_]) {
+						offset_ = o + size;
+						return blocks_[current_] + o;
+					}
+					++current_;
+					offset_ = 0;
+				}
+
+				size_t s = std::max(block_size_, size + alignment);
+				blocks_.reserve(blocks_.size() + 1);
+				sizes_.reserve(sizes_.size() + 1);
+				char* b = static_cast<char*>(::operator new(s));
+				blocks_.push_back(b);
+				sizes_.push_back(s);
+				current_ = blocks_.size() - 1;
+				offset_ = 0;
+
+				return allocate(size, alignment);
+			}
+
+		/**
+		 * 全領域の再利用
+		 * @note	それまでに確保した領域は全て無効になる。
+		 */
+		void
+		reset()
+			{
+				current_ = 0;
+				offset_ = 0;
+			}
+	};
+
+	/**
+	 * アリーナから確保するアロケータ
+	 */
+	template<typename T>
+	class KDArenaAllocator
+	{
+	public:
+
+		typedef T value_type;	///< 要素の型
+		typedef std::true_type propagate_on_container_copy_assignment;	///< コピー時にアリーナも引き継ぐ
+		typedef std::true_type propagate_on_container_move_assignment;	///< ムーブ時にアリーナも引き継ぐ
+		typedef std::true_type propagate_on_container_swap;	///< 交換時にアリーナも交換する
+
+		KDArena* arena;		///< アリーナ
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	arena	アリーナ
+		 */
+		explicit KDArenaAllocator(KDArena* arena = 0)
+			: arena(arena)
+			{
+				;
+			}
+
+		/**
+		 * 異なる要素型のアロケータからの変換
+		 * @param[in]	other	アロケータ
+		 */
+		template<typename U>
+		KDArenaAllocator(const KDArenaAllocator<U>& other)
+			: arena(other.arena)
+			{
+				;
+			}
+
+		/**
+		 * 領域の確保
+		 * @param[in]	n	要素数
+		 * @return	確保した領域
+		 */
+		T*
+		allocate(size_t n)
+			{
+				assert(arena);
+
+				return static_cast<T*>(arena->allocate(sizeof(T) * n, alignof(T)));
+			}
+
+		/**
+		 * 領域の解放 (何もしない)
+		 */
+		void
+		deallocate(T*,
+				   size_t)
+			{
+				;
+			}
+	};
+
+	/**
+	 * アロケータの比較
+	 * @param[in]	l	左辺
+	 * @param[in]	r	右辺
+	 * @return	同じアリーナなら true
+	 */
+	template<typename T, typename U>
+	inline bool
+	operator ==(const KDArenaAllocator<T>& l,
+				const KDArenaAllocator<U>& r)
+	{
+		return l.arena == r.arena;
+	}
+
+	/**
+	 * アロケータの比較
+	 * @param[in]	l	左辺
+	 * @param[in]	r	右辺
+	 * @return	異なるアリーナなら true
+	 */
+	template<typename T, typename U>
+	inline bool
+	operator !=(const KDArenaAllocator<T>& l,
+				const KDArenaAllocator<U>& r)
+	{
+		return l.arena != r.arena;
+	}
+};
+
+#endif	// __KD_ARENA_HPP__
@@ -0,0 +1,962 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_dual_tree.hpp
+ * @brief	配列版kD木の部分木の組を同時に辿る探索 (dual-tree)
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_DUAL_TREE_HPP__
+#define	__KD_DUAL_TREE_HPP__	"kd_dual_tree.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <queue>
+#include <limits>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <utility>
+#include <type_traits>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 2つの包含矩形の間の距離 (順位付け用の値)
+	 * @param[in]	metric	距離 (次元ごとの差から求まるもの)
+	 * @param[in]	la	矩形の下限
+	 * @param[in]	ua	矩形の上限
+	 * @param[in]	lb	矩形の下限
+	 * @param[in]	ub	矩形の上限
+	 * @return	2つの矩形の最も近い点の間の距離
+	 */
+	template<typename TYPE, size_t N, typename METRIC>
+	inline double
+	KDBoxDistance(const METRIC& metric,
+				  const std::array<TYPE, N>& la,
+				  const std::array<TYPE, N>& ua,
+				  const std::array<TYPE, N>& lb,
+				  const std::array<TYPE, N>& ub)
+	{
+		std::array<TYPE, N> a, b;	// 2つの矩形の最も近い点 (次元ごと)
+		for (size_t i(0); i < N; ++i) {
+			if (ua[i] < lb[i]) {
+				a[i] = ua[i];
+				b[i] = lb[i];
+			}
+			else if (ub[i] < la[i]) {
+				a[i] = la[i];
+				b[i] = ub[i];
+			}
+			else {
+				a[i] = b[i] = la[i] < lb[i] ? lb[i] : la[i];
+			}
+		}
+		return metric.distance(a, b);
+	}
+
+	/**
+	 * 距離が半径以内の点の組を表す述語
+	 * @note	@a overlap は2つの包含矩形の間の距離の下限で判定する。
+				包含矩形の間の距離を次元ごとの差から求めるので、周期境界と大円距離には使えない。
+	 */
+	template<typename TYPE, size_t N, typename METRIC = KDEuclidean<TYPE, N> >
+	struct KDWithinPredicate
+	{
+		static_assert(!std::is_same<METRIC, KDHaversine<TYPE, N> >::value &&
+					  !std::is_same<METRIC, KDPeriodic<TYPE, N> >::value,
+					  "KDWithinPredicate requires a coordinate-wise metric.");
+
+		METRIC metric;	///< 距離
+		double key;		///< 半径 (順位付け用の距離)
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	radius	半径 (実距離)
+		 * @param[in]	metric	距離
+		 */
+		explicit KDWithinPredicate(double radius,
+								   const METRIC& metric = METRIC())
+			: metric(metric), key(metric.rank(radius))
+			{
+				;
+			}
+
+		/**
+		 * 点の組の判定
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	半径以内なら true
+		 */
+		bool
+		operator ()(const std::array<TYPE, N>& a,
+					const std::array<TYPE, N>& b) const
+			{
+				return metric.distance(a, b) <= key;
+			}
+
+		/**
+		 * 包含矩形の組の判定
+		 * @param[in]	la	矩形の下限
+		 * @param[in]	ua	矩形の上限
+		 * @param[in]	lb	矩形の下限
+		 * @param[in]	ub	矩形の上限
+		 * @return	半径以内の点の組を含み得るなら true
+		 */
+		bool
+		overlap(const std::array<TYPE, N>& la,
+				const std::array<TYPE, N>& ua,
+				const std::array<TYPE, N>& lb,
+				const std::array<TYPE, N>& ub) const
+			{
+				return KDBoxDistance(metric, la, ua, lb, ub) <= key;
+			}
+	};
+
+	/**
+	 * 次元ごとの差が許容範囲以内の点の組を表す述語
+	 */
+	template<typename TYPE, size_t N>
+	struct KDBoxPredicate
+	{
+		std::array<TYPE, N> tolerance;	///< 次元ごとの許容範囲 (0以上)
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	tolerance	次元ごとの許容範囲
+		 */
+		explicit KDBoxPredicate(const std::array<TYPE, N>& tolerance)
+			: tolerance(tolerance)
+			{
+				;
+			}
+
+		/**
+		 * 点の組の判定
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	全ての次元で差が許容範囲以内なら true
+		 */
+		bool
+		operator ()(const std::array<TYPE, N>& a,
+					const std::array<TYPE, N>& b) const
+			{
+				for (size_t i(0); i < N; ++i) {
+					if (a[i] + tolerance[i] < b[i] || b[i] + tolerance[i] < a[i]) return false;
+				}
+				return true;
+			}
+
+		/**
+		 * 包含矩形の組の判定
+		 * @param[in]	la	矩形の下限
+		 * @param[in]	ua	矩形の上限
+		 * @param[in]	lb	矩形の下限
+		 * @param[in]	ub	矩形の上限
+		 * @return	条件を満たす点の組を含み得るなら true
+		 */
+		bool
+		overlap(const std::array<TYPE, N>& la,
+				const std::array<TYPE, N>& ua,
+				const std::array<TYPE, N>& lb,
+				const std::array<TYPE, N>& ub) const
+			{
+				for (size_t i(0); i < N; ++i) {
+					if (ua[i] + tolerance[i] < lb[i] || ub[i] + tolerance[i] < la[i]) return false;
+				}
+				return true;
+			}
+	};
+
+	/**
+	 * 配列版kD木の部分木の組を同時に辿る探索 (dual-tree)
+	 * @note	準備済みのkD木に、部分木ごとの包含矩形と点の数を加えたもの。
+				探索中はkD木とデータを変更しないこと。
+	 */
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t> >
+	class KDDualTree
+	{
+	private:
+
+		typedef KDDualTree<TYPE, N, ALLOCATOR> Tree;
+
+		/**
+		 * 作業の種類
+		 */
+		enum Type
+		{
+			WHOLE,		///< 部分木 @a a 内の全ての組
+			CROSS,		///< 部分木 @a a と部分木 @a b の組
+			SINGLE,		///< 部分木 @a a の根の点と部分木 @a b の組
+			REVERSE		///< 部分木 @a b の根の点と部分木 @a a の組
+		};
+
+		/**
+		 * 並列に処理する作業
+		 */
+		struct Task
+		{
+			double cost;	///< 組の数の見積もり
+			Type type;		///< 作業の種類
+			size_t a;		///< 1つ目の木の部分木の根
+			size_t b;		///< 2つ目の木の部分木の根
+
+			/**
+			 * 比較
+			 * @param[in]	other	比較対象
+			 * @return	自身の方が小さければ true
+			 */
+			bool
+			operator <(const Task& other) const
+				{
+					return cost < other.cost;
+				}
+		};
+
+		const KDSearchArray<TYPE, N, ALLOCATOR>& tree_;	///< kD木
+		const std::array<TYPE, N>* values_;		///< データ (0の場合は木の並び順の座標)
+		std::vector<std::array<TYPE, N> > lower_;	///< 各部分木の包含矩形の下限
+		std::vector<std::array<TYPE, N> > upper_;	///< 各部分木の包含矩形の上限
+		std::vector<size_t> count_;				///< 各部分木の点の数
+
+		/**
+		 * 部分木の有無の判定
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	部分木があれば true
+		 */
+		bool
+		valid(size_t index) const
+			{
+				return index < tree_.capacity() && tree_.at(index) < ~0LU;
+			}
+
+		/**
+		 * 座標の取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	座標
+		 */
+		const std::array<TYPE, N>&
+		point(size_t index) const
+			{
+				return tree_.coordinate(values_, index);
+			}
+
+		/**
+		 * 削除されていない点か否かの判定
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	削除されていなければ true
+		 */
+		bool
+		live(size_t index) const
+			{
+				return !tree_.erased(tree_.at(index));
+			}
+
+		/**
+		 * 部分木の包含矩形と点の数の計算
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 */
+		void
+		bound(size_t index)
+			{
+				lower_[index] = upper_[index] = point(index);
+				count_[index] = 1;
+
+				for (size_t k(index * 2 + 1); k <= index * 2 + 2; ++k) {
+					if (!valid(k)) continue;
+					bound(k);
+					for (size_t i(0); i < N; ++i) {
+						if (lower_[k][i] < lower_[index][i]) lower_[index][i] = lower_[k][i];
+						if (upper_[index][i] < upper_[k][i]) upper_[index][i] = upper_[k][i];
+					}
+					count_[index] += count_[k];
+				}
+			}
+
+		/**
+		 * 点と部分木の組の処理
+		 * @param[in]	p	点を持つ木
+		 * @param[in]	i	点の @a p 内のインデックス
+		 * @param[in]	q	部分木を持つ木
+		 * @param[in]	j	部分木の根の @a q 内のインデックス
+		 * @param[in]	flip	@a q の点を先にして述語と @a sink に渡すなら true
+		 * @param[in]	predicate	述語
+		 * @param[in,out]	sink	条件を満たす点の組 (データ内のインデックス) の受け取り先
+		 */
+		template<typename PREDICATE, typename SINK>
+		static void
+		Single(const Tree& p,
+			   size_t i,
+			   const Tree& q,
+			   size_t j,
+			   bool flip,
+			   const PREDICATE& predicate,
+			   SINK& sink)
+			{
+				if (!q.valid(j)) return;
+
+				const std::array<TYPE, N>& x = p.point(i);
+				if (!(flip
+					  ? predicate.overlap(q.lower_[j], q.upper_[j], x, x)
+					  : predicate.overlap(x, x, q.lower_[j], q.upper_[j]))) return;
+
+				if (q.live(j)) {
+					const std::array<TYPE, N>& y = q.point(j);
+					if (flip ? predicate(y, x) : predicate(x, y)) {
+						if (flip) sink(q.tree_.at(j), p.tree_.at(i));
+						else sink(p.tree_.at(i), q.tree_.at(j));
+					}
+				}
+
+				Single(p, i, q, j * 2 + 1, flip, predicate, sink);
+				Single(p, i, q, j * 2 + 2, flip, predicate, sink);
+			}
+
+		/**
+		 * 2つの部分木の組の処理
+		 * @param[in]	p	1つ目の木
+		 * @param[in]	a	1つ目の部分木の根
+		 * @param[in]	q	2つ目の木
+		 * @param[in]	b	2つ目の部分木の根
+		 * @param[in]	predicate	述語
+		 * @param[in,out]	sink	条件を満たす点の組の受け取り先
+		 * @note	点の多い方の部分木を根の点と2つの子に分けて辿る。
+		 */
+		template<typename PREDICATE, typename SINK>
+		static void
+		Cross(const Tree& p,
+			  size_t a,
+			  const Tree& q,
+			  size_t b,
+			  const PREDICATE& predicate,
+			  SINK& sink)
+			{
+				if (!p.valid(a) || !q.valid(b)) return;
+				if (!predicate.overlap(p.lower_[a], p.upper_[a], q.lower_[b], q.upper_[b])) return;
+
+				if (q.count_[b] <= p.count_[a]) {
+					if (p.live(a)) Single(p, a, q, b, false, predicate, sink);
+					Cross(p, a * 2 + 1, q, b, predicate, sink);
+					Cross(p, a * 2 + 2, q, b, predicate, sink);
+				}
+				else {
+					if (q.live(b)) Single(q, b, p, a, true, predicate, sink);
+					Cross(p, a, q, b * 2 + 1, predicate, sink);
+					Cross(p, a, q, b * 2 + 2, predicate, sink);
+				}
+			}
+
+		/**
+		 * 部分木内の全ての組の処理 (自己結合)
+		 * @param[in]	p	木
+		 * @param[in]	a	部分木の根
+		 * @param[in]	predicate	述語
+		 * @param[in,out]	sink	条件を満たす点の組の受け取り先
+		 * @note	根の点と子孫、2つの子の間、各子の中に分けるので、各組は1回だけ現れる。
+		 */
+		template<typename PREDICATE, typename SINK>
+		static void
+		Whole(const Tree& p,
+			  size_t a,
+			  const PREDICATE& predicate,
+			  SINK& sink)
+			{
+				if (!p.valid(a)) return;
+
+				size_t l = a * 2 + 1;
+				size_t r = a * 2 + 2;
+				if (p.live(a)) {
+					Single(p, a, p, l, false, predicate, sink);
+					Single(p, a, p, r, false, predicate, sink);
+				}
+				Whole(p, l, predicate, sink);
+				Whole(p, r, predicate, sink);
+				Cross(p, l, p, r, predicate, sink);
+			}
+
+		/**
+		 * 作業の追加
+		 * @param[in]	p	1つ目の木
+		 * @param[in]	q	2つ目の木
+		 * @param[in]	type	作業の種類
+		 * @param[in]	a	1つ目の木の部分木の根
+		 * @param[in]	b	2つ目の木の部分木の根
+		 * @param[in]	predicate	述語
+		 * @param[in,out]	tasks	作業
+		 */
+		template<typename PREDICATE>
+		static void
+		Push(const Tree& p,
+			 const Tree& q,
+			 Type type,
+			 size_t a,
+			 size_t b,
+			 const PREDICATE& predicate,
+			 std::priority_queue<Task>& tasks)
+			{
+				Task t;
+				t.type = type;
+				t.a = a;
+				t.b = b;
+
+				switch (type) {
+				case WHOLE:
+					if (!p.valid(a)) return;
+					t.cost = 0.5 * p.count_[a] * p.count_[a];
+					break;
+				case CROSS:
+					if (!p.valid(a) || !q.valid(b)) return;
+					if (!predicate.overlap(p.lower_[a], p.upper_[a], q.lower_[b], q.upper_[b])) return;
+					t.cost = (double)p.count_[a] * q.count_[b];
+					break;
+				case SINGLE:
+					if (!p.valid(a) || !q.valid(b) || !p.live(a)) return;
+					t.cost = (double)q.count_[b];
+					break;
+				case REVERSE:
+					if (!p.valid(a) || !q.valid(b) || !q.live(b)) return;
+					t.cost = (double)p.count_[a];
+					break;
+				}
+
+				tasks.push(t);
+			}
+
+		/**
+		 * 作業の分割 (大きい作業から順に、並列に処理できる数になるまで分ける)
+		 * @param[in]	p	1つ目の木
+		 * @param[in]	q	2つ目の木 (自己結合では @a p と同じ)
+		 * @param[in]	whole	自己結合なら true
+		 * @param[in]	goal	作業の数の目標
+		 * @param[in]	predicate	述語
+		 * @param[out]	tasks	作業
+		 */
+		template<typename PREDICATE>
+		static void
+		Plan(const Tree& p,
+			 const Tree& q,
+			 bool whole,
+			 size_t goal,
+			 const PREDICATE& predicate,
+			 std::vector<Task>& tasks)
+			{
+				std::priority_queue<Task> h;
+				if (whole) Push(p, q, WHOLE, 0, 0, predicate, h);
+				else Push(p, q, CROSS, 0, 0, predicate, h);
+
+				while (!h.empty() && h.size() < goal) {
+					Task t = h.top();
+					if (t.type == SINGLE || t.type == REVERSE) break;
+					h.pop();
+
+					size_t a = t.a;
+					size_t b = t.b;
+					if (t.type == WHOLE) {
+						Push(p, p, SINGLE, a, a * 2 + 1, predicate, h);
+						Push(p, p, SINGLE, a, a * 2 + 2, predicate, h);
+						Push(p, p, WHOLE, a * 2 + 1, 0, predicate, h);
+						Push(p, p, WHOLE, a * 2 + 2, 0, predicate, h);
+						Push(p, p, CROSS, a * 2 + 1, a * 2 + 2, predicate, h);
+					}
+					else if (q.count_[b] <= p.count_[a]) {
+						Push(p, q, SINGLE, a, b, predicate, h);
+						Push(p, q, CROSS, a * 2 + 1, b, predicate, h);
+						Push(p, q, CROSS, a * 2 + 2, b, predicate, h);
+					}
+					else {
+						Push(p, q, REVERSE, a, b, predicate, h);
+						Push(p, q, CROSS, a, b * 2 + 1, predicate, h);
+						Push(p, q, CROSS, a, b * 2 + 2, predicate, h);
+					}
+				}
+
+				tasks.clear();
+				tasks.reserve(h.size());
+				for (; !h.empty(); h.pop()) tasks.push_back(h.top());	// 大きい順
+			}
+
+		/**
+		 * 作業の並列処理
+		 * @param[in]	p	1つ目の木
+		 * @param[in]	q	2つ目の木 (自己結合では @a p と同じ)
+		 * @param[in]	whole	自己結合なら true
+		 * @param[in]	predicate	述語
+		 * @param[in,out]	sink	条件を満たす点の組の受け取り先 (複数のスレッドから同時に呼ばれる)
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 */
+		template<typename PREDICATE, typename SINK>
+		static void
+		Run(const Tree& p,
+			const Tree& q,
+			bool whole,
+			const PREDICATE& predicate,
+			SINK& sink,
+			size_t threads)
+			{
+				if (threads == 0) threads = std::thread::hardware_concurrency();
+				if (threads == 0) threads = 1;
+
+				std::vector<Task> tasks;
+				Plan(p, q, whole, threads * 16, predicate, tasks);
+
+				std::atomic<size_t> next(0);
+				auto work = [&] () {
+					for (size_t i; (i = next.fetch_add(1)) < tasks.size();) {
+						const Task& t = tasks[i];
+						switch (t.type) {
+						case WHOLE:		Whole(p, t.a, predicate, sink); break;
+						case CROSS:		Cross(p, t.a, q, t.b, predicate, sink); break;
+						case SINGLE:	Single(p, t.a, q, t.b, false, predicate, sink); break;
+						case REVERSE:	Single(q, t.b, p, t.a, true, predicate, sink); break;
+						}
+					}
+				};
+
+				std::vector<std::thread> workers;
+				try {
+					workers.reserve(threads - 1);	// 作ったスレッドを格納する時に例外を出さないように
+				}
+				catch (...) {
+					threads = 1;	// 呼び出したスレッドだけで処理する
+				}
+				for (size_t i(1); i < threads && i < tasks.size(); ++i) {
+					try {
+						workers.push_back(std::thread(work));
+					}
+					catch (...) {
+						break;
+					}
+				}
+				work();
+				for (auto& w : workers) w.join();
+			}
+
+		/**
+		 * 全点の近傍探索 (dual-tree) の状態
+		 * @note	近傍は探索点ごとに (順位付け用の距離, インデックス) の最大ヒープとして持つ。
+					探索点の部分木ごとに、含まれる探索点の k 番目の距離の最大値 (共有の上限) を持ち、
+					参照点の部分木までの距離がそれを超えれば、その組をまとめて枝刈りする。
+					探索点の部分木は1つのスレッドだけが扱うので、排他制御は要らない。
+		 */
+		template<typename METRIC>
+		struct Nearest
+		{
+			const Tree& queries;	///< 探索点の木
+			const Tree& references;	///< 参照点の木
+			size_t k;				///< 探索する点の数
+			bool self;				///< 自己結合 (自身を近傍に含めない) なら true
+			const METRIC& metric;	///< 距離
+			std::vector<std::pair<double, size_t> >& neighbors;	///< 探索点ごとの近傍 (k 個ずつ)
+			std::vector<size_t> counts;	///< 探索点ごとの近傍の数
+			std::vector<double> bounds;	///< 探索点の部分木ごとの共有の上限
+
+			/**
+			 * コンストラクタ
+			 * @param[in]	queries	探索点の木
+			 * @param[in]	references	参照点の木
+			 * @param[in]	k	探索する点の数
+			 * @param[in]	self	自己結合なら true
+			 * @param[in]	metric	距離
+			 * @param[out]	neighbors	探索点ごとの近傍
+			 */
+			Nearest(const Tree& queries,
+					const Tree& references,
+					size_t k,
+					bool self,
+					const METRIC& metric,
+					std::vector<std::pair<double, size_t> >& neighbors)
+				: queries(queries), references(references), k(k), self(self), metric(metric),
+				  neighbors(neighbors), counts(), bounds()
+				{
+					;
+				}
+
+			/**
+			 * 探索点の k 番目の距離
+			 * @param[in]	id	探索点のデータ内のインデックス
+			 * @return	距離 (近傍が k 個未満なら無限大)
+			 */
+			double
+			kth(size_t id) const
+				{
+					return counts[id] < k ? std::numeric_limits<double>::infinity() : neighbors[id * k].first;
+				}
+
+			/**
+			 * 近傍の候補の追加
+			 * @param[in]	id	探索点のデータ内のインデックス
+			 * @param[in]	key	距離
+			 * @param[in]	neighbor	参照点のデータ内のインデックス
+			 */
+			void
+			offer(size_t id,
+				  double key,
+				  size_t neighbor)
+				{
+					auto b = neighbors.begin() + id * k;
+					if (counts[id] < k) {
+						b[counts[id]++] = std::make_pair(key, neighbor);
+						std::push_heap(b, b + counts[id]);
+					}
+					else if (key < b->first) {
+						std::pop_heap(b, b + k);
+						b[k-1] = std::make_pair(key, neighbor);
+						std::push_heap(b, b + k);
+					}
+				}
+
+			/**
+			 * 探索点の部分木の共有の上限の更新
+			 * @param[in]	q	探索点の部分木の根
+			 */
+			void
+			tighten(size_t q)
+				{
+					double b = queries.live(q) ? kth(queries.tree_.at(q)) : 0.0;
+					for (size_t c(q * 2 + 1); c <= q * 2 + 2; ++c) {
+						if (queries.valid(c) && b < bounds[c]) b = bounds[c];
+					}
+					bounds[q] = b;
+				}
+
+			/**
+			 * 1つの探索点と参照点の部分木の探索
+			 * @param[in]	q	探索点の kD木内のインデックス
+			 * @param[in]	r	参照点の部分木の根
+			 */
+			void
+			point(size_t q,
+				  size_t r)
+				{
+					const std::array<TYPE, N>& x = queries.point(q);
+					size_t id = queries.tree_.at(q);
+					if (kth(id) < KDBoxDistance(metric, x, x, references.lower_[r], references.upper_[r])) return;
+
+					if (references.live(r) && !(self && references.tree_.at(r) == id)) {
+						double d = metric.distance(x, references.point(r));
+						if (d < kth(id)) offer(id, d, references.tree_.at(r));
+					}
+
+					size_t a = r * 2 + 1;
+					size_t b = r * 2 + 2;
+					if (!references.valid(a)) std::swap(a, b);
+					if (!references.valid(a)) return;
+					if (references.valid(b) &&
+						KDBoxDistance(metric, x, x, references.lower_[b], references.upper_[b]) <
+						KDBoxDistance(metric, x, x, references.lower_[a], references.upper_[a])) {
+						std::swap(a, b);
+					}
+					point(q, a);
+					if (references.valid(b)) point(q, b);
+				}
+
+			/**
+			 * 探索点の部分木と1つの参照点の組の処理
+			 * @param[in]	q	探索点の部分木の根
+			 * @param[in]	r	参照点の kD木内のインデックス
+			 */
+			void
+			reference(size_t q,
+					  size_t r)
+				{
+					if (!queries.valid(q)) return;
+
+					const std::array<TYPE, N>& y = references.point(r);
+					if (bounds[q] < KDBoxDistance(metric, queries.lower_[q], queries.upper_[q], y, y)) return;
+
+					size_t id = queries.tree_.at(q);
+					if (queries.live(q) && !(self && references.tree_.at(r) == id)) {
+						double d = metric.distance(queries.point(q), y);
+						if (d < kth(id)) offer(id, d, references.tree_.at(r));
+					}
+
+					reference(q * 2 + 1, r);
+					reference(q * 2 + 2, r);
+					tighten(q);
+				}
+
+			/**
+			 * 探索点の部分木と参照点の部分木の組の処理
+			 * @param[in]	q	探索点の部分木の根
+			 * @param[in]	r	参照点の部分木の根
+			 * @note	点の多い方の部分木を根の点と2つの子に分けて辿る。
+			 */
+			void
+			dual(size_t q,
+				 size_t r)
+				{
+					if (!queries.valid(q) || !references.valid(r)) return;
+					if (bounds[q] < KDBoxDistance(metric, queries.lower_[q], queries.upper_[q],
+												  references.lower_[r], references.upper_[r])) return;
+
+					if (references.count_[r] <= queries.count_[q]) {
+						if (queries.live(q)) point(q, r);
+						dual(q * 2 + 1, r);
+						dual(q * 2 + 2, r);
+						tighten(q);
+						return;
+					}
+
+					if (references.live(r)) reference(q, r);
+
+					size_t a = r * 2 + 1;
+					size_t b = r * 2 + 2;
+					if (references.valid(a) && references.valid(b) &&
+						KDBoxDistance(metric, queries.lower_[q], queries.upper_[q], references.lower_[b], references.upper_[b]) <
+						KDBoxDistance(metric, queries.lower_[q], queries.upper_[q], references.lower_[a], references.upper_[a])) {
+						std::swap(a, b);
+					}
+					dual(q, a);
+					dual(q, b);
+				}
+		};
+
+		/**
+		 * 全点の近傍探索
+		 * @param[in]	queries	探索点の木
+		 * @param[in]	references	参照点の木
+		 * @param[in]	k	探索する点の数
+		 * @param[in]	self	自己結合なら true
+		 * @param[out]	neighbors	探索点ごとの近傍
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 * @param[in]	metric	距離
+		 * @return	成功したら true
+		 * @note	探索点の木を一定の深さで部分木に分け、部分木ごとに並列に処理する。
+					それより上の探索点は1点ずつ並列に処理する。
+		 */
+		template<typename METRIC>
+		static bool
+		Search(const Tree& queries,
+			   const Tree& references,
+			   size_t k,
+			   bool self,
+			   std::vector<std::pair<double, size_t> >& neighbors,
+			   size_t threads,
+			   const METRIC& metric)
+			{
+				assert(0 < k);
+
+				if (threads == 0) threads = std::thread::hardware_concurrency();
+				if (threads == 0) threads = 1;
+
+				size_t n = queries.tree_.size();
+				Nearest<METRIC> s(queries, references, k, self, metric, neighbors);
+				std::vector<std::pair<size_t, bool> > tasks;	// (探索点のインデックス, 部分木なら true)
+				try {
+					neighbors.assign(n * k, std::make_pair(std::numeric_limits<double>::infinity(), ~0LU));
+					s.counts.assign(n, 0);
+					s.bounds.assign(queries.tree_.capacity(), std::numeric_limits<double>::infinity());
+
+					size_t level(0);
+					while (((size_t)1 << level) < threads * 16 && level < 48) ++level;
+					for (size_t i(0); i < queries.tree_.capacity() && i + 1 < ((size_t)2 << level); ++i) {
+						if (!queries.valid(i)) continue;
+						if (i + 1 < ((size_t)1 << level)) {
+							if (queries.live(i)) tasks.push_back(std::make_pair(i, false));
+						}
+						else {
+							tasks.push_back(std::make_pair(i, true));
+						}
+					}
+				}
+				catch (...) {
+					return false;
+				}
+				std::sort(tasks.begin(), tasks.end(), [&queries] (const std::pair<size_t, bool>& l, const std::pair<size_t, bool>& r) {
+						return (l.second ? queries.count_[l.first] : 1) > (r.second ? queries.count_[r.first] : 1);
+					});
+
+				if (references.valid(0)) {
+					std::atomic<size_t> next(0);
+					auto work = [&] () {
+						for (size_t i; (i = next.fetch_add(1)) < tasks.size();) {
+							if (tasks[i].second) s.dual(tasks[i].first, 0);
+							else s.point(tasks[i].first, 0);
+						}
+					};
+
+					std::vector<std::thread> workers;
+					try {
+						workers.reserve(threads - 1);	// 作ったスレッドを格納する時に例外を出さないように
+					}
+					catch (...) {
+						threads = 1;	// 呼び出したスレッドだけで処理する
+					}
+					for (size_t i(1); i < threads && i < tasks.size(); ++i) {
+						try {
+							workers.push_back(std::thread(work));
+						}
+						catch (...) {
+							break;
+						}
+					}
+					work();
+					for (auto& w : workers) w.join();
+				}
+
+				for (size_t i(0); i < n; ++i) {
+					auto b = neighbors.begin() + i * k;
+					std::sort_heap(b, b + s.counts[i]);
+				}
+
+				return true;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	tree	準備済みのkD木
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 */
+		KDDualTree(const KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+				   const std::array<TYPE, N>* values)
+			: tree_(tree), values_(values), lower_(), upper_(), count_()
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDDualTree(const KDDualTree<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDDualTree&
+		operator =(const KDDualTree<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDDualTree()
+			{
+				;
+			}
+
+		/**
+		 * 部分木ごとの包含矩形と点の数の準備
+		 * @return	成功したら true
+		 */
+		bool
+		prepare()
+			{
+				try {
+					lower_.resize(tree_.capacity());
+					upper_.resize(tree_.capacity());
+					count_.assign(tree_.capacity(), 0);
+				}
+				catch (...) {
+					return false;
+				}
+
+				if (valid(0)) bound(0);
+
+				return true;
+			}
+
+		/**
+		 * 距離が半径以内の全ての点の組の列挙 (自己結合)
+		 * @param[in]	radius	半径 (実距離)
+		 * @param[in,out]	sink	点の組 (データ内のインデックス) を受け取る関数 (複数のスレッドから同時に呼ばれる)
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照)
+		 * @note	各組は (i, j) と (j, i) のどちらか一方だけを1回渡す。点と自身の組は渡さない。
+		 */
+		template<typename SINK, typename METRIC = KDEuclidean<TYPE, N> >
+		void
+		all_pairs_within(double radius,
+						 SINK sink,
+						 size_t threads = 0,
+						 const METRIC& metric = METRIC()) const
+			{
+				assert(count_.size() == tree_.capacity());
+
+				KDWithinPredicate<TYPE, N, METRIC> predicate(radius, metric);
+				Run(*this, *this, true, predicate, sink, threads);
+			}
+
+		/**
+		 * 2つのkD木の点の組のうち述語を満たすものの列挙 (空間結合)
+		 * @param[in]	a	1つ目のkD木
+		 * @param[in]	b	2つ目のkD木
+		 * @param[in]	predicate	述語 (KDWithinPredicate, KDBoxPredicate 等)
+		 * @param[in,out]	sink	点の組 (@a a のデータ内のインデックス, @a b のデータ内のインデックス) を
+							受け取る関数 (複数のスレッドから同時に呼ばれる)
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 * @note	述語は点の組を判定する operator () と、2つの包含矩形が条件を満たす点の組を
+					含み得るかを判定する overlap を持つこと。overlap が false の部分木の組は辿らない。
+		 */
+		template<typename PREDICATE, typename SINK>
+		static void
+		Join(const KDDualTree<TYPE, N, ALLOCATOR>& a,
+			 const KDDualTree<TYPE, N, ALLOCATOR>& b,
+			 const PREDICATE& predicate,
+			 SINK sink,
+			 size_t threads = 0)
+			{
+				assert(a.count_.size() == a.tree_.capacity());
+				assert(b.count_.size() == b.tree_.capacity());
+
+				Run(a, b, false, predicate, sink, threads);
+			}
+
+		/**
+		 * 全ての点の近傍探索 (自身は含めない)
+		 * @param[in]	k	探索する点の数
+		 * @param[out]	neighbors	点 i の近傍を近い順に並べた (順位付け用の距離, インデックス) の組を
+							[i * k, i * k + k) に持つ (足りない分は (無限大, ~0LU))
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照)
+		 * @return	成功したら true
+		 */
+		template<typename METRIC = KDEuclidean<TYPE, N> >
+		bool
+		all_nearest(size_t k,
+					std::vector<std::pair<double, size_t> >& neighbors,
+					size_t threads = 0,
+					const METRIC& metric = METRIC()) const
+			{
+				static_assert(!std::is_same<METRIC, KDHaversine<TYPE, N> >::value &&
+							  !std::is_same<METRIC, KDPeriodic<TYPE, N> >::value,
+							  "all_nearest requires a coordinate-wise metric.");
+				assert(count_.size() == tree_.capacity());
+
+				return Search(*this, *this, k, true, neighbors, threads, metric);
+			}
+
+		/**
+		 * 探索点ごとの参照点の近傍探索
+		 * @param[in]	queries	探索点の木
+		 * @param[in]	references	参照点の木
+		 * @param[in]	k	探索する点の数
+		 * @param[out]	neighbors	探索点 i の近傍を近い順に並べた (順位付け用の距離, 参照点のインデックス) の組を
+							[i * k, i * k + k) に持つ (足りない分は (無限大, ~0LU))
+		 * @param[in]	threads	スレッド数 (0ならハードウェアのスレッド数)
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照)
+		 * @return	成功したら true
+		 */
+		template<typename METRIC = KDEuclidean<TYPE, N> >
+		static bool
+		AllNearest(const KDDualTree<TYPE, N, ALLOCATOR>& queries,
+				   const KDDualTree<TYPE, N, ALLOCATOR>& references,
+				   size_t k,
+				   std::vector<std::pair<double, size_t> >& neighbors,
+				   size_t threads = 0,
+				   const METRIC& metric = METRIC())
+			{
+				static_assert(!std::is_same<METRIC, KDHaversine<TYPE, N> >::value &&
+							  !std::is_same<METRIC, KDPeriodic<TYPE, N> >::value,
+							  "AllNearest requires a coordinate-wise metric.");
+				assert(queries.count_.size() == queries.tree_.capacity());
+				assert(references.count_.size() == references.tree_.capacity());
+
+				return Search(queries, references, k, false, neighbors, threads, metric);
+			}
+	};
+};
+
+#endif	// __KD_DUAL_TREE_HPP__
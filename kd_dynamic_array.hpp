@@ -0,0 +1,208 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_dynamic_array.hpp
+ * @brief	要素の追加ができる配列版kD木 (対数法)
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_DYNAMIC_ARRAY_HPP__
+#define	__KD_DYNAMIC_ARRAY_HPP__	"kd_dynamic_array.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <utility>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 要素の追加ができる配列版kD木 (対数法)
+	 * @note	大きさ 2^i 以下の KDSearchArray を階層ごとに持ち、追加時は
+				下位の階層を併合して作り直す (Bentley-Saxe)。
+				階層の再構築は KDSearchArray::prepare (各段を std::stable_sort で分割するので
+				m 点で O(m log^2 m)) なので、追加は償却 O(log^3 n) 回の比較
+				(__KD_SEARCH_ARRAY_USE_SELECTION__ を定義すれば期待 O(log^2 n))。
+				探索は全階層を順に探索する。
+	 */
+	template<typename TYPE, size_t N>
+	class KDDynamicArray
+	{
+	private:
+
+		/**
+		 * 階層
+		 */
+		struct Level
+		{
+			std::vector<std::array<TYPE, N> > values;	///< データ
+			std::vector<size_t> ids;					///< 各点の追加順のインデックス
+			KDSearchArray<TYPE, N> tree;				///< kD木 (点が無ければ空)
+
+			/**
+			 * コンストラクタ
+			 */
+			Level()
+				: values(), ids(), tree()
+				{
+					;
+				}
+		};
+
+		std::vector<Level> levels_;	///< 階層 (階層 i の点の数は 2^i 以下)
+		size_t size_;				///< 点の数
+
+		/**
+		 * 点の併合と階層の再構築
+		 * @param[in]	values	追加するデータ
+		 * @param[in]	length	配列 @a values の要素数
+		 * @return	成功したら true
+		 */
+		bool
+		merge(const std::array<TYPE, N>* values,
+			  size_t length)
+			{
+				assert(values);
+				assert(0 < length);
+
+				Level g;
+				g.values.assign(values, values + length);
+				g.ids.resize(length);
+				for (size_t i(0); i < length; ++i) g.ids[i] = size_ + i;
+
+				// 空いていて収まる階層まで、途中の階層を取り込みながら進む
+				size_t i(0);
+				for (; i < levels_.size(); ++i) {
+					Level& h = levels_[i];
+					if (!h.values.empty()) {
+						g.values.insert(g.values.end(), h.values.begin(), h.values.end());
+						g.ids.insert(g.ids.end(), h.ids.begin(), h.ids.end());
+					}
+					else if (g.values.size() <= ((size_t)1 << i)) {
+						break;
+					}
+				}
+				while (g.values.size() > ((size_t)1 << i)) ++i;
+				if (levels_.size() <= i) levels_.resize(i + 1);
+
+				if (!g.tree.prepare(g.values.data(), g.values.size())) return false;
+
+				for (size_t j(0); j < i; ++j) {
+					std::vector<std::array<TYPE, N> >().swap(levels_[j].values);
+					std::vector<size_t>().swap(levels_[j].ids);
+					levels_[j].tree = KDSearchArray<TYPE, N>();
+				}
+				levels_[i].values.swap(g.values);
+				levels_[i].ids.swap(g.ids);
+				levels_[i].tree = std::move(g.tree);
+				size_ += length;
+
+				return true;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDDynamicArray()
+			: levels_(), size_(0)
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDDynamicArray(const KDDynamicArray<TYPE, N>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDDynamicArray&
+		operator =(const KDDynamicArray<TYPE, N>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDDynamicArray()
+			{
+				;
+			}
+
+		/**
+		 * 点の追加
+		 * @param[in]	value	追加する点
+		 * @return	追加した点のインデックス (失敗したら ~0LU)
+		 */
+		size_t
+		insert(const std::array<TYPE, N>& value)
+			{
+				size_t k(size_);
+
+				try {
+					if (!merge(&value, 1)) return ~0LU;
+				}
+				catch (...) {
+					return ~0LU;
+				}
+
+				return k;
+			}
+
+		/**
+		 * 点の一括追加
+		 * @param[in]	values	追加するデータ
+		 * @param[in]	length	配列 @a values の要素数
+		 * @return	成功したら true
+		 * @note	追加した点のインデックスは、追加前の @a size から連番になる。
+		 */
+		bool
+		insert(const std::array<TYPE, N>* values,
+			   size_t length)
+			{
+				assert(values);
+
+				if (length == 0) return true;
+
+				try {
+					return merge(values, length);
+				}
+				catch (...) {
+					return false;
+				}
+			}
+
+		/**
+		 * kD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス (追加順)
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points) const
+			{
+				for (const auto& h : levels_) {
+					if (h.values.empty()) continue;
+					size_t k = points.size();
+					h.tree.find(h.values.data(), from, to, points);
+					for (size_t i(k); i < points.size(); ++i) points[i] = h.ids[points[i]];
+				}
+			}
+
+		/**
+		 * 点の数の取得
+		 * @return	点の数
+		 */
+		size_t
+		size() const
+			{
+				return size_;
+			}
+	};
+};
+
+#endif	// __KD_DYNAMIC_ARRAY_HPP__
@@ -0,0 +1,455 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_external_builder.hpp
+ * @brief	メモリに載らないデータからの配列版kD木の構築
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_EXTERNAL_BUILDER_HPP__
+#define	__KD_EXTERNAL_BUILDER_HPP__	"kd_external_builder.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kd_mapped_image.hpp"
+
+namespace ys
+{
+	/**
+	 * メモリに載らないデータからの配列版kD木の構築
+	 * @note	入力は std::array<TYPE, N> を並べた固定長バイナリ・ファイル。
+				サンプリングした分割点でファイル上の点を分割し、
+				メモリ予算に収まった部分木からメモリ上で構築する。
+				出力は KDMappedImage::Open で開けるファイル・イメージ。
+	 */
+	template<typename TYPE, size_t N>
+	class KDExternalBuilder
+	{
+	private:
+
+		/**
+		 * 作業ファイル上の点
+		 */
+		struct Record
+		{
+			uint64_t id;				///< 入力ファイル内のインデックス
+			std::array<TYPE, N> point;	///< 座標
+		};
+
+		int work_[2];				///< 作業ファイル (交互に分割先として使う)
+		std::string path_[2];		///< 作業ファイルのパス
+		size_t budget_;				///< メモリ予算 (点の数)
+		size_t* tree_;				///< 出力先の配列 @a tree_
+		std::array<TYPE, N>* points_;	///< 出力先の座標 (出力しない場合は0)
+		std::mt19937 mt_;			///< メルセンヌ・ツイスタ (32bit版)
+
+		/**
+		 * 点の比較 (座標が等しい場合はインデックスで比較する)
+		 * @param[in]	l	左辺
+		 * @param[in]	r	右辺
+		 * @param[in]	d	比較する次元
+		 * @return	@a l が @a r より小さければ true
+		 */
+		static bool
+		Less(const Record& l,
+			 const Record& r,
+			 size_t d)
+			{
+				if (l.point[d] != r.point[d]) return l.point[d] < r.point[d];
+				return l.id < r.id;
+			}
+
+		/**
+		 * ファイルの読み込み
+		 * @param[in]	fd	ファイル・ディスクリプタ
+		 * @param[out]	buffer	読み込み先
+		 * @param[in]	from	読み込む最初の点
+		 * @param[in]	length	読み込む点の数
+		 * @return	成功したら true
+		 */
+		static bool
+		Read(int fd,
+			 Record* buffer,
+			 size_t from,
+			 size_t length)
+			{
+				char* p = reinterpret_cast<char*>(buffer);
+				size_t s = sizeof(Record) * length;
+				off_t o = (off_t)(sizeof(Record) * from);
+
+				while (0 < s) {
+					ssize_t r = ::pread(fd, p, s, o);
+					if (r <= 0) return false;
+					p += r;
+					s -= (size_t)r;
+					o += r;
+				}
+
+				return true;
+			}
+
+		/**
+		 * ファイルへの書き込み
+		 * @param[in]	fd	ファイル・ディスクリプタ
+		 * @param[in]	buffer	書き込む点
+		 * @param[in]	from	書き込む最初の位置
+		 * @param[in]	length	書き込む点の数
+		 * @return	成功したら true
+		 */
+		static bool
+		Write(int fd,
+			  const Record* buffer,
+			  size_t from,
+			  size_t length)
+			{
+				const char* p = reinterpret_cast<const char*>(buffer);
+				size_t s = sizeof(Record) * length;
+				off_t o = (off_t)(sizeof(Record) * from);
+
+				while (0 < s) {
+					ssize_t r = ::pwrite(fd, p, s, o);
+					if (r <= 0) return false;
+					p += r;
+					s -= (size_t)r;
+					o += r;
+				}
+
+				return true;
+			}
+
+		/**
+		 * メモリ上での部分木の構築
+		 * @param[in,out]	buffer	部分木の点
+		 * @param[in]	index	kD木の中で確定させるインデックス
+		 * @param[in]	from	配列 @a buffer の処理領域の始点
+		 * @param[in]	to	配列 @a buffer の処理領域の終点
+		 * @param[in]	depth	kD木の深さ
+		 */
+		void
+		build(Record* buffer,
+			  size_t index,
+			  size_t from,
+			  size_t to,
+			  size_t depth)
+			{
+				assert(buffer);
+				assert(from <= to);
+
+				size_t k = (from + to) / 2;
+				size_t d = depth % N;
+				if (from < to) {
+					std::nth_element(buffer + from, buffer + k, buffer + to + 1,
+									 [d] (const Record& l, const Record& r) { return Less(l, r, d); });
+				}
+				tree_[index] = (size_t)buffer[k].id;
+				if (points_) points_[index] = buffer[k].point;
+
+				if (from < k) build(buffer, index * 2 + 1, from, k - 1, depth + 1);
+				if (k < to) build(buffer, index * 2 + 2, k + 1, to, depth + 1);
+			}
+
+		/**
+		 * ファイル上の点の分割
+		 * @param[in]	source	分割元の作業ファイル (0 or 1)
+		 * @param[in]	from	分割する最初の点
+		 * @param[in]	to	分割する最後の点
+		 * @param[in]	d	比較する次元
+		 * @param[out]	bounds	分割後の各バケットの始点 (末尾は @a to + 1)
+		 * @return	成功したら true
+		 * @note	分割結果は、もう一方の作業ファイルの同じ範囲に書き出す。
+		 */
+		bool
+		partition(size_t source,
+				  size_t from,
+				  size_t to,
+				  size_t d,
+				  std::vector<size_t>& bounds)
+			{
+				size_t c = to + 1 - from;
+				size_t b = std::min<size_t>(c / (budget_ / 4) + 2, 1024);
+				size_t s = std::min<size_t>(b * 32, budget_ / 4);
+
+				// 分割点のサンプリング
+				std::vector<Record> splitters(s);
+				for (size_t i(0); i < s; ++i) {
+					if (!Read(work_[source], &splitters[i], from + mt_() % c, 1)) return false;
+				}
+				std::sort(splitters.begin(), splitters.end(),
+						  [d] (const Record& l, const Record& r) { return Less(l, r, d); });
+				for (size_t i(1); i < b; ++i) splitters[i-1] = splitters[s * i / b];
+				splitters.resize(b - 1);
+
+				auto bucket = [&splitters, d] (const Record& r) -> size_t {
+					return std::upper_bound(splitters.begin(), splitters.end(), r,
+											[d] (const Record& l, const Record& r) { return Less(l, r, d); }) - splitters.begin();
+				};
+
+				// バケットの大きさの計数
+				size_t l = budget_ / 2;
+				std::vector<Record> input(l);
+				std::vector<size_t> count(b, 0);
+				for (size_t i(from); i <= to; i += l) {
+					size_t m = std::min(l, to + 1 - i);
+					if (!Read(work_[source], input.data(), i, m)) return false;
+					for (size_t j(0); j < m; ++j) ++count[bucket(input[j])];
+				}
+
+				bounds.assign(1, from);
+				for (size_t i(0); i < b; ++i) bounds.push_back(bounds.back() + count[i]);
+
+				// バケットへの振り分け
+				size_t w = std::max<size_t>(budget_ / 2 / b, 1);
+				std::vector<Record> output(w * b);
+				std::vector<size_t> filled(b, 0);
+				std::vector<size_t> written(bounds.begin(), bounds.end() - 1);
+				int target = work_[1 - source];
+
+				for (size_t i(from); i <= to; i += l) {
+					size_t m = std::min(l, to + 1 - i);
+					if (!Read(work_[source], input.data(), i, m)) return false;
+					for (size_t j(0); j < m; ++j) {
+						size_t k = bucket(input[j]);
+						output[k * w + filled[k]++] = input[j];
+						if (filled[k] < w) continue;
+						if (!Write(target, &output[k * w], written[k], w)) return false;
+						written[k] += w;
+						filled[k] = 0;
+					}
+				}
+
+				for (size_t k(0); k < b; ++k) {
+					if (filled[k] && !Write(target, &output[k * w], written[k], filled[k])) return false;
+				}
+
+				return true;
+			}
+
+		/**
+		 * ファイル上での部分木の構築
+		 * @param[in]	source	部分木の点がある作業ファイル (0 or 1)
+		 * @param[in]	index	kD木の中で確定させるインデックス
+		 * @param[in]	from	処理領域の始点
+		 * @param[in]	to	処理領域の終点
+		 * @param[in]	depth	kD木の深さ
+		 * @return	成功したら true
+		 */
+		bool
+		build_external(size_t source,
+					   size_t index,
+					   size_t from,
+					   size_t to,
+					   size_t depth)
+			{
+				assert(from <= to);
+
+				size_t c = to + 1 - from;
+				if (c <= budget_) {
+					std::vector<Record> buffer(c);
+					if (!Read(work_[source], buffer.data(), from, c)) return false;
+					build(buffer.data(), index, 0, c - 1, depth);
+					return true;
+				}
+
+				size_t k = (from + to) / 2;
+				size_t d = depth % N;
+				std::vector<size_t> bounds;
+
+				// 中央値を含むバケットがメモリに収まるまで分割を繰り返す
+				if (!partition(source, from, to, d, bounds)) return false;
+				source = 1 - source;
+
+				size_t f(from), t(to);
+				for (;;) {
+					size_t i = std::upper_bound(bounds.begin(), bounds.end(), k) - bounds.begin() - 1;
+					f = bounds[i];
+					t = bounds[i+1] - 1;
+					if (t + 1 - f <= budget_) break;
+					if (!partition(source, f, t, d, bounds)) return false;
+
+					std::vector<Record> buffer(budget_);
+					for (size_t j(f); j <= t; j += budget_) {
+						size_t m = std::min(budget_, t + 1 - j);
+						if (!Read(work_[1 - source], buffer.data(), j, m)) return false;
+						if (!Write(work_[source], buffer.data(), j, m)) return false;
+					}
+				}
+
+				std::vector<Record> buffer(t + 1 - f);
+				if (!Read(work_[source], buffer.data(), f, buffer.size())) return false;
+				std::nth_element(buffer.begin(), buffer.begin() + (k - f), buffer.end(),
+								 [d] (const Record& l, const Record& r) { return Less(l, r, d); });
+				if (!Write(work_[source], buffer.data(), f, buffer.size())) return false;
+
+				tree_[index] = (size_t)buffer[k - f].id;
+				if (points_) points_[index] = buffer[k - f].point;
+				std::vector<Record>().swap(buffer);
+
+				if (from < k && !build_external(source, index * 2 + 1, from, k - 1, depth + 1)) return false;
+				if (k < to && !build_external(source, index * 2 + 2, k + 1, to, depth + 1)) return false;
+
+				return true;
+			}
+
+		/**
+		 * 作業ファイルの削除
+		 */
+		void
+		clear()
+			{
+				for (size_t i(0); i < 2; ++i) {
+					if (work_[i] < 0) continue;
+					::close(work_[i]);
+					::unlink(path_[i].c_str());
+					work_[i] = -1;
+				}
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDExternalBuilder()
+			: work_(), path_(), budget_(0), tree_(0), points_(0), mt_(1)
+			{
+				work_[0] = work_[1] = -1;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDExternalBuilder(const KDExternalBuilder<TYPE, N>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDExternalBuilder&
+		operator =(const KDExternalBuilder<TYPE, N>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDExternalBuilder()
+			{
+				clear();
+			}
+
+		/**
+		 * kD木のファイル・イメージの構築
+		 * @param[in]	input	入力ファイルのパス (std::array<TYPE, N> を並べたもの)
+		 * @param[in]	output	出力ファイルのパス (作業ファイルも同じディレクトリに作る)
+		 * @param[in]	budget	メモリ予算 (byte)
+		 * @param[in]	coordinates	木の並び順の座標も出力するなら true
+		 * @return	成功したら true
+		 */
+		bool
+		build(const char* input,
+			  const char* output,
+			  size_t budget,
+			  bool coordinates = false)
+			{
+				assert(input);
+				assert(output);
+
+				budget_ = budget / sizeof(Record);
+				if (budget_ < 1024) return false;
+
+				struct stat st;
+				if (::stat(input, &st) != 0 || st.st_size == 0 ||
+					(size_t)st.st_size % sizeof(std::array<TYPE, N>) != 0) return false;
+
+				size_t n = (size_t)st.st_size / sizeof(std::array<TYPE, N>);
+				size_t l(1);
+				while (l <= n) l *= 2;
+
+				KDSearchArrayImage header;
+				std::memset(&header, 0, sizeof(header));
+				std::memcpy(header.magic, "KDSARRAY", 8);
+				header.version = 1;
+				header.dimension = (uint32_t)N;
+				header.type_size = (uint32_t)sizeof(TYPE);
+				header.index_size = (uint32_t)sizeof(size_t);
+				header.length = l;
+				header.size = n;
+				header.tree = KDSearchArrayImage::Align(sizeof(header));
+				if (coordinates) header.points = KDSearchArrayImage::Align(header.tree + sizeof(size_t) * l);
+				size_t s = header.points ? header.points + sizeof(std::array<TYPE, N>) * l : header.tree + sizeof(size_t) * l;
+
+				// 作業ファイルに点とインデックスを書き出す
+				for (size_t i(0); i < 2; ++i) {
+					path_[i] = std::string(output) + (i == 0 ? ".work0" : ".work1");
+					work_[i] = ::open(path_[i].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+					if (work_[i] < 0) {
+						clear();
+						return false;
+					}
+				}
+
+				std::FILE* file = std::fopen(input, "rb");
+				if (!file) {
+					clear();
+					return false;
+				}
+
+				bool f(true);
+				std::vector<std::array<TYPE, N> > points(std::min(n, budget_));
+				std::vector<Record> records(points.size());
+				for (size_t i(0); f && i < n; i += points.size()) {
+					size_t m = std::min(points.size(), n - i);
+					f = std::fread(points.data(), sizeof(std::array<TYPE, N>), m, file) == m;
+					for (size_t j(0); f && j < m; ++j) {
+						records[j].id = i + j;
+						records[j].point = points[j];
+					}
+					f = f && Write(work_[0], records.data(), i, m);
+				}
+				std::fclose(file);
+				std::vector<std::array<TYPE, N> >().swap(points);
+				std::vector<Record>().swap(records);
+
+				// 出力ファイルをマップして構築
+				int fd = f ? ::open(output, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+				void* m(MAP_FAILED);
+				if (0 <= fd && ::ftruncate(fd, (off_t)s) == 0) {
+					m = ::mmap(0, s, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				}
+				if (0 <= fd) ::close(fd);
+
+				if (m == MAP_FAILED) {
+					clear();
+					if (0 <= fd) ::unlink(output);
+					return false;
+				}
+
+				char* base = static_cast<char*>(m);
+				std::memcpy(base, &header, sizeof(header));
+				tree_ = reinterpret_cast<size_t*>(base + header.tree);
+				points_ = header.points ? reinterpret_cast<std::array<TYPE, N>*>(base + header.points) : 0;
+				std::fill(tree_, tree_ + l, ~0LU);
+
+				f = build_external(0, 0, 0, n - 1, 0);
+				f = (::msync(m, s, MS_SYNC) == 0) && f;
+				::munmap(m, s);
+				tree_ = 0;
+				points_ = 0;
+				clear();
+
+				if (!f) ::unlink(output);
+
+				return f;
+			}
+	};
+};
+
+#endif	// __KD_EXTERNAL_BUILDER_HPP__
@@ -0,0 +1,291 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_forest.hpp
+ * @brief	高次元の近似近傍探索のための無作為に回転したkD木の森
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_FOREST_HPP__
+#define	__KD_FOREST_HPP__	"kd_forest.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <queue>
+#include <random>
+#include <utility>
+#include <functional>
+#include <unordered_set>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 無作為に回転したkD木の森
+	 * @note	木ごとにデータを無作為な直交行列で回転してから配列版kD木を構築する。
+				回転で距離は変わらないので、全ての木を1つの優先度付きキューで近い順に辿り、
+				距離を計算する点の数の上限 @a checks の中で近傍を探す。
+				木は座標を引き取る (@a prepare_owned) ので、元のデータは準備後は不要。
+	 */
+	template<typename TYPE, size_t N>
+	class KDForest
+	{
+	private:
+
+		typedef std::array<double, N> Vector;	///< 回転後の座標
+		typedef std::array<Vector, N> Matrix;	///< 直交行列 (行ごと)
+
+		std::vector<KDSearchArray<double, N> > trees_;	///< 木
+		std::vector<Matrix> rotations_;	///< 各木の回転
+
+		/**
+		 * 無作為な直交行列の生成
+		 * @param[out]	matrix	直交行列
+		 * @param[in,out]	mt	メルセンヌ・ツイスタ
+		 * @note	正規乱数の行列をグラム・シュミット法で正規直交化する。
+		 */
+		static void
+		Rotation(Matrix& matrix,
+				 std::mt19937& mt)
+			{
+				std::normal_distribution<double> u(0.0, 1.0);
+
+				for (size_t i(0); i < N; ++i) {
+					for (;;) {
+						for (auto& x : matrix[i]) x = u(mt);
+						for (size_t j(0); j < i; ++j) {
+							double s(0.0);
+							for (size_t k(0); k < N; ++k) s += matrix[i][k] * matrix[j][k];
+							for (size_t k(0); k < N; ++k) matrix[i][k] -= s * matrix[j][k];
+						}
+						double s(0.0);
+						for (auto x : matrix[i]) s += x * x;
+						if (1e-12 < s) {
+							s = std::sqrt(s);
+							for (auto& x : matrix[i]) x /= s;
+							break;
+						}
+					}
+				}
+			}
+
+		/**
+		 * 座標の回転
+		 * @param[in]	matrix	直交行列
+		 * @param[in]	point	座標
+		 * @return	回転後の座標
+		 */
+		static Vector
+		Rotate(const Matrix& matrix,
+			   const std::array<TYPE, N>& point)
+			{
+				Vector v;
+				for (size_t i(0); i < N; ++i) {
+					double s(0.0);
+					for (size_t j(0); j < N; ++j) s += matrix[i][j] * (double)point[j];
+					v[i] = s;
+				}
+				return v;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDForest()
+			: trees_(), rotations_()
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDForest(const KDForest<TYPE, N>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDForest&
+		operator =(const KDForest<TYPE, N>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDForest()
+			{
+				;
+			}
+
+		/**
+		 * 森の準備
+		 * @param[in]	values	データ (準備後は不要)
+		 * @param[in]	length	配列 @a values の要素数
+		 * @param[in]	trees	木の数
+		 * @param[in]	seed	回転を生成する乱数の種
+		 * @return	成功したら true
+		 */
+		bool
+		prepare(const std::array<TYPE, N>* values,
+				size_t length,
+				size_t trees = 4,
+				uint32_t seed = 1)
+			{
+				assert(values);
+				assert(0 < length);
+				assert(0 < trees);
+
+				trees_.clear();
+				rotations_.clear();
+
+				try {
+					std::mt19937 mt(seed);
+					std::vector<Vector> rotated(length);
+					trees_.resize(trees);
+					rotations_.resize(trees);
+					for (size_t t(0); t < trees; ++t) {
+						Rotation(rotations_[t], mt);
+						for (size_t i(0); i < length; ++i) rotated[i] = Rotate(rotations_[t], values[i]);
+						if (!trees_[t].prepare_owned(rotated.data(), length)) throw std::bad_alloc();
+					}
+				}
+				catch (...) {
+					trees_.clear();
+					rotations_.clear();
+					return false;
+				}
+
+				return true;
+			}
+
+		/**
+		 * 近傍探索 (近似も可)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	k	探索する点の数
+		 * @param[out]	neighbors	近い順に並べた (距離の2乗, 点のインデックス) の組
+		 * @param[in]	epsilon	許容する誤差 (KDSearchArray::nearest と同じ)
+		 * @param[in]	checks	距離を計算する点の数の上限 (全ての木の合計、0なら上限無し)
+		 * @note	全ての木の部分木を、次元ごとの分割面までの距離から求めた下限の小さい順に辿る。
+		 */
+		void
+		nearest(const std::array<TYPE, N>& query,
+				size_t k,
+				std::vector<std::pair<double, size_t> >& neighbors,
+				double epsilon = 0.0,
+				size_t checks = 0) const
+			{
+				assert(!trees_.empty());
+				assert(0.0 <= epsilon);
+
+				struct Bin
+				{
+					double bound;	///< 部分木までの距離の2乗の下限
+					size_t tree;	///< 木
+					size_t index;	///< 部分木の根の kD木内のインデックス
+					size_t depth;	///< 部分木の根の深さ
+					Vector offsets;	///< 次元ごとの分割面までの距離の2乗
+
+					bool
+					operator >(const Bin& other) const
+						{
+							return other.bound < bound;
+						}
+				};
+
+				neighbors.clear();
+				if (k == 0) return;
+
+				std::vector<Vector> queries(trees_.size());
+				for (size_t t(0); t < trees_.size(); ++t) queries[t] = Rotate(rotations_[t], query);
+
+				double e = (1.0 + epsilon) * (1.0 + epsilon);
+				std::priority_queue<Bin, std::vector<Bin>, std::greater<Bin> > bins;
+				std::priority_queue<std::pair<double, size_t> > best;
+				std::unordered_set<size_t> seen;
+				size_t c(0);
+
+				for (size_t t(0); t < trees_.size(); ++t) {
+					Bin b;
+					b.bound = 0.0;
+					b.tree = t;
+					b.index = 0;
+					b.depth = 0;
+					b.offsets.fill(0.0);
+					bins.push(b);
+				}
+
+				while (!bins.empty() && (checks == 0 || c < checks)) {
+					Bin b = bins.top();
+					bins.pop();
+					if (best.size() == k && best.top().first <= b.bound * e) break;
+
+					const KDSearchArray<double, N>& tree = trees_[b.tree];
+					const Vector& q = queries[b.tree];
+					size_t i = b.index;
+					size_t depth = b.depth;
+					while (i < tree.capacity() && tree.at(i) < ~0LU && (checks == 0 || c < checks)) {
+						const Vector& p = tree.coordinate(0, i);
+						if (seen.insert(tree.at(i)).second) {
+							double s(0.0);
+							for (size_t j(0); j < N; ++j) s += (q[j] - p[j]) * (q[j] - p[j]);
+							++c;
+							if (best.size() < k) {
+								best.push(std::make_pair(s, tree.at(i)));
+							}
+							else if (s < best.top().first) {
+								best.pop();
+								best.push(std::make_pair(s, tree.at(i)));
+							}
+						}
+
+						size_t d = depth % N;
+						double x = q[d] - p[d];
+						size_t f = i * 2 + (x < 0.0 ? 2 : 1);
+						double h = b.bound - b.offsets[d] + x * x;
+						if (f < tree.capacity() && tree.at(f) < ~0LU && (best.size() < k || h * e < best.top().first)) {
+							Bin n(b);
+							n.bound = h;
+							n.index = f;
+							n.depth = depth + 1;
+							n.offsets[d] = x * x;
+							bins.push(n);
+						}
+
+						i = i * 2 + (x < 0.0 ? 1 : 2);
+						++depth;
+					}
+				}
+
+				neighbors.resize(best.size());
+				for (size_t i(best.size()); 0 < i; --i) {
+					neighbors[i-1] = best.top();
+					best.pop();
+				}
+			}
+
+		/**
+		 * 木の数の取得
+		 * @return	木の数
+		 */
+		size_t
+		trees() const
+			{
+				return trees_.size();
+			}
+
+		/**
+		 * 点の数の取得
+		 * @return	点の数
+		 */
+		size_t
+		size() const
+			{
+				return trees_.empty() ? 0 : trees_[0].size();
+			}
+	};
+};
+
+#endif	// __KD_FOREST_HPP__
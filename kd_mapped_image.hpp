@@ -0,0 +1,200 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_mapped_image.hpp
+ * @brief	配列版kD木のファイル・イメージの保存とマップ (POSIX)
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_MAPPED_IMAGE_HPP__
+#define	__KD_MAPPED_IMAGE_HPP__	"kd_mapped_image.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <array>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * kD木のファイル・イメージのヘッダ
+	 * @note	ヘッダの後ろに (64byte境界に揃えて) 配列 @a tree_ が、
+				その後ろに (64byte境界に揃えて) 木の並び順の座標が任意で続く。
+	 */
+	struct KDSearchArrayImage
+	{
+		char magic[8];			///< マジック・ナンバー "KDSARRAY"
+		uint32_t version;		///< フォーマットのバージョン
+		uint32_t dimension;		///< 次元数
+		uint32_t type_size;		///< 座標の要素のバイト数
+		uint32_t index_size;	///< インデックスのバイト数
+		uint64_t length;		///< 配列 @a tree_ の容量
+		uint64_t size;			///< 点の数
+		uint64_t tree;			///< 配列 @a tree_ のオフセット
+		uint64_t points;		///< 座標のオフセット (座標が無い場合は0)
+
+		/**
+		 * 64byte境界への切り上げ
+		 * @param[in]	offset	オフセット
+		 * @return	切り上げたオフセット
+		 */
+		static uint64_t
+		Align(uint64_t offset)
+			{
+				return (offset + 63) & ~(uint64_t)63;
+			}
+	};
+
+	/**
+	 * 配列版kD木のファイル・イメージの保存とマップ
+	 * @note	mmap 等の POSIX の機能を使うので、kd_search_array.hpp から分けている。
+	 */
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t> >
+	class KDMappedImage
+	{
+	private:
+
+		/**
+		 * マップしたファイル・イメージの解放
+		 * @param[in]	mapping	マップした領域
+		 * @param[in]	size	マップした領域のバイト数
+		 */
+		static void
+		Unmap(void* mapping,
+			  size_t size)
+			{
+				::munmap(mapping, size);
+			}
+
+	public:
+
+		/**
+		 * kD木のファイル・イメージの保存
+		 * @param[in]	tree	準備済みのkD木
+		 * @param[in]	path	保存先のファイル・パス
+		 * @param[in]	values	データ (0以外なら木の並び順に並べ替えた座標も保存する)
+		 * @return	成功したら true
+		 * @note	KDSearchArray::erase による削除済みの印は保存しない。
+		 */
+		static bool
+		Save(const KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+			 const char* path,
+			 const std::array<TYPE, N>* values = 0)
+			{
+				assert(path);
+				assert(tree.tree_);
+
+				KDSearchArrayImage header;
+				std::memset(&header, 0, sizeof(header));
+				std::memcpy(header.magic, "KDSARRAY", 8);
+				header.version = 1;
+				header.dimension = (uint32_t)N;
+				header.type_size = (uint32_t)sizeof(TYPE);
+				header.index_size = (uint32_t)sizeof(size_t);
+				header.length = tree.length_;
+				header.size = tree.size_;
+				header.tree = KDSearchArrayImage::Align(sizeof(header));
+				if (values || tree.points_) {
+					header.points = KDSearchArrayImage::Align(header.tree + sizeof(size_t) * tree.length_);
+				}
+
+				std::FILE* file = std::fopen(path, "wb");
+				if (!file) return false;
+
+				const char padding[64] = {0};
+				bool f = std::fwrite(&header, sizeof(header), 1, file) == 1;
+				f = f && std::fwrite(padding, header.tree - sizeof(header), 1, file) == 1;
+				f = f && std::fwrite(tree.tree_, sizeof(size_t), tree.length_, file) == tree.length_;
+
+				if (f && header.points) {
+					size_t o = header.tree + sizeof(size_t) * tree.length_;
+					if (o < header.points) f = std::fwrite(padding, header.points - o, 1, file) == 1;
+					std::array<TYPE, N> empty;
+					std::memset(&empty, 0, sizeof(empty));
+					for (size_t i(0); f && i < tree.length_; ++i) {
+						const std::array<TYPE, N>& p = tree.tree_[i] < ~0LU ? tree.coordinate(values, i) : empty;
+						f = std::fwrite(&p, sizeof(p), 1, file) == 1;
+					}
+				}
+
+				f = (std::fclose(file) == 0) && f;
+				if (!f) std::remove(path);
+
+				return f;
+			}
+
+		/**
+		 * kD木のファイル・イメージのマップ
+		 * @param[out]	tree	マップしたイメージを使うkD木 (元の内容は解放する)
+		 * @param[in]	path	@a Save で保存したファイル・パス
+		 * @return	成功したら true (壊れたイメージなら false)
+		 * @note	逆シリアライズせず、マップした領域をそのまま探索に使う。
+					座標付きのイメージなら、引数 @a values 無しの find が使える。
+					探索で範囲外を読まないよう、各要素が ~0LU か点の数未満であることを確かめる。
+		 */
+		static bool
+		Open(KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+			 const char* path)
+			{
+				assert(path);
+
+				int fd = ::open(path, O_RDONLY);
+				if (fd < 0) return false;
+
+				struct stat st;
+				void* m(MAP_FAILED);
+				if (::fstat(fd, &st) == 0 && sizeof(KDSearchArrayImage) <= (size_t)st.st_size) {
+					m = ::mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				}
+				::close(fd);
+				if (m == MAP_FAILED) return false;
+
+				const KDSearchArrayImage* header = static_cast<const KDSearchArrayImage*>(m);
+				size_t s = (size_t)st.st_size;
+				bool f = std::memcmp(header->magic, "KDSARRAY", 8) == 0 &&
+					header->version == 1 &&
+					header->dimension == (uint32_t)N &&
+					header->type_size == (uint32_t)sizeof(TYPE) &&
+					header->index_size == (uint32_t)sizeof(size_t) &&
+					header->length != 0 &&
+					header->size <= header->length &&
+					header->tree % 64 == 0 &&
+					header->points % 64 == 0 &&
+					header->tree <= s &&
+					header->length <= (s - header->tree) / sizeof(size_t);
+				if (f && header->points) {
+					f = header->points <= s && header->length <= (s - header->points) / sizeof(std::array<TYPE, N>);
+				}
+
+				const size_t* t = reinterpret_cast<const size_t*>(static_cast<const char*>(m) + header->tree);
+				for (size_t i(0); f && i < header->length; ++i) {
+					f = t[i] == ~0LU || t[i] < header->size;
+				}
+
+				if (!f) {
+					::munmap(m, s);
+					return false;
+				}
+
+				tree.clear();
+
+				char* base = static_cast<char*>(m);
+				tree.mapping_ = m;
+				tree.mapping_size_ = s;
+				tree.unmap_ = Unmap;
+				tree.tree_ = reinterpret_cast<size_t*>(base + header->tree);
+				tree.length_ = header->length;
+				tree.size_ = header->size;
+				if (header->points) tree.points_ = reinterpret_cast<const std::array<TYPE, N>*>(base + header->points);
+
+				return true;
+			}
+	};
+};
+
+#endif	// __KD_MAPPED_IMAGE_HPP__
@@ -0,0 +1,581 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_metric.hpp
+ * @brief	配列版kD木の近傍探索で使う距離
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_METRIC_HPP__
+#define	__KD_METRIC_HPP__	"kd_metric.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <array>
+#include <algorithm>
+
+namespace ys
+{
+	/*
+	 * 距離は次のメンバ関数を持つクラスとして渡す (仮想関数は使わず、探索関数に展開される)。
+	 *  - distance(a, b): 2点間の順位付け用の値 (実距離に対して単調増加する値)
+	 *  - plane(query, d, split): 次元 @a d の分割面 @a split の向こう側の点までの順位付け用の値の下限
+	 *  - update(bound, old, now): 次元ごとの下限を @a old から @a now (@a old 以上) に更新した時の部分木までの下限
+	 *  - rank(r): 実距離から順位付け用の値への変換
+	 *  - unrank(key): 順位付け用の値から実距離への変換
+	 */
+
+	/**
+	 * ユークリッド距離 (順位付け用の値は2乗)
+	 */
+	template<typename TYPE, size_t N>
+	struct KDEuclidean
+	{
+		/**
+		 * 2点間の距離の2乗
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	距離の2乗
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double s(0.0);
+				for (size_t i(0); i < N; ++i) {
+					double x = (double)a[i] - (double)b[i];
+					s += x * x;
+				}
+				return s;
+			}
+
+		/**
+		 * 分割面までの距離の2乗
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元
+		 * @param[in]	split	分割面の座標
+		 * @return	距離の2乗
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				double x = (double)query[d] - (double)split;
+				return x * x;
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				return bound - old + now;
+			}
+
+		/**
+		 * 実距離から順位付け用の値への変換
+		 * @param[in]	r	実距離
+		 * @return	順位付け用の値
+		 */
+		double
+		rank(double r) const
+			{
+				return r * r;
+			}
+
+		/**
+		 * 順位付け用の値から実距離への変換
+		 * @param[in]	key	順位付け用の値
+		 * @return	実距離
+		 */
+		double
+		unrank(double key) const
+			{
+				return std::sqrt(key);
+			}
+	};
+
+	/**
+	 * 次元ごとに重みを付けたユークリッド距離 (順位付け用の値は2乗)
+	 * @note	距離の2乗は (重み × 差) の2乗の総和。単位の異なる次元を混ぜる場合に使う。
+	 */
+	template<typename TYPE, size_t N>
+	struct KDWeightedEuclidean
+	{
+		std::array<double, N> weights;	///< 次元ごとの重み (0以上)
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	weights	次元ごとの重み
+		 */
+		explicit KDWeightedEuclidean(const std::array<double, N>& weights)
+			: weights(weights)
+			{
+				;
+			}
+
+		/**
+		 * 2点間の距離の2乗
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	距離の2乗
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double s(0.0);
+				for (size_t i(0); i < N; ++i) {
+					double x = weights[i] * ((double)a[i] - (double)b[i]);
+					s += x * x;
+				}
+				return s;
+			}
+
+		/**
+		 * 分割面までの距離の2乗
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元
+		 * @param[in]	split	分割面の座標
+		 * @return	距離の2乗
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				double x = weights[d] * ((double)query[d] - (double)split);
+				return x * x;
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				return bound - old + now;
+			}
+
+		/**
+		 * 実距離から順位付け用の値への変換
+		 * @param[in]	r	実距離
+		 * @return	順位付け用の値
+		 */
+		double
+		rank(double r) const
+			{
+				return r * r;
+			}
+
+		/**
+		 * 順位付け用の値から実距離への変換
+		 * @param[in]	key	順位付け用の値
+		 * @return	実距離
+		 */
+		double
+		unrank(double key) const
+			{
+				return std::sqrt(key);
+			}
+	};
+
+	/**
+	 * マンハッタン距離 (L1)
+	 */
+	template<typename TYPE, size_t N>
+	struct KDManhattan
+	{
+		/**
+		 * 2点間の距離
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	距離
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double s(0.0);
+				for (size_t i(0); i < N; ++i) s += std::fabs((double)a[i] - (double)b[i]);
+				return s;
+			}
+
+		/**
+		 * 分割面までの距離
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元
+		 * @param[in]	split	分割面の座標
+		 * @return	距離
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				return std::fabs((double)query[d] - (double)split);
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				return bound - old + now;
+			}
+
+		/**
+		 * 実距離から順位付け用の値への変換
+		 * @param[in]	r	実距離
+		 * @return	順位付け用の値 (実距離のまま)
+		 */
+		double
+		rank(double r) const
+			{
+				return r;
+			}
+
+		/**
+		 * 順位付け用の値から実距離への変換
+		 * @param[in]	key	順位付け用の値
+		 * @return	実距離 (そのまま)
+		 */
+		double
+		unrank(double key) const
+			{
+				return key;
+			}
+	};
+
+	/**
+	 * チェビシェフ距離 (L∞)
+	 */
+	template<typename TYPE, size_t N>
+	struct KDChebyshev
+	{
+		/**
+		 * 2点間の距離
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	距離
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double s(0.0);
+				for (size_t i(0); i < N; ++i) s = std::max(s, std::fabs((double)a[i] - (double)b[i]));
+				return s;
+			}
+
+		/**
+		 * 分割面までの距離
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元
+		 * @param[in]	split	分割面の座標
+		 * @return	距離
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				return std::fabs((double)query[d] - (double)split);
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限 (使わない)
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 * @note	次元ごとの下限は辿るにつれて増える一方なので、最大値で更新できる。
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				(void)old;
+				return std::max(bound, now);
+			}
+
+		/**
+		 * 実距離から順位付け用の値への変換
+		 * @param[in]	r	実距離
+		 * @return	順位付け用の値 (実距離のまま)
+		 */
+		double
+		rank(double r) const
+			{
+				return r;
+			}
+
+		/**
+		 * 順位付け用の値から実距離への変換
+		 * @param[in]	key	順位付け用の値
+		 * @return	実距離 (そのまま)
+		 */
+		double
+		unrank(double key) const
+			{
+				return key;
+			}
+	};
+
+	/**
+	 * 周期境界のユークリッド距離 (最小イメージ規約、順位付け用の値は2乗)
+	 * @note	次元 i は @a lower[i] から長さ @a length[i] の周期を持つ (長さ0の次元は周期無し)。
+				点の座標は周期の範囲内に収めておくこと。
+	 */
+	template<typename TYPE, size_t N>
+	struct KDPeriodic
+	{
+		std::array<double, N> lower;	///< 周期の範囲の下限
+		std::array<double, N> length;	///< 周期の長さ (0なら周期無し)
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	lower	周期の範囲の下限
+		 * @param[in]	length	周期の長さ
+		 */
+		KDPeriodic(const std::array<double, N>& lower,
+				   const std::array<double, N>& length)
+			: lower(lower), length(length)
+			{
+				;
+			}
+
+		/**
+		 * 周期を考えた差の絶対値
+		 * @param[in]	d	次元
+		 * @param[in]	x	差
+		 * @return	最小イメージの差の絶対値
+		 */
+		double
+		gap(size_t d,
+			double x) const
+			{
+				x = std::fabs(x);
+				if (0.0 < length[d]) {
+					x = std::fmod(x, length[d]);
+					x = std::min(x, length[d] - x);
+				}
+				return x;
+			}
+
+		/**
+		 * 2点間の距離の2乗
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	距離の2乗
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double s(0.0);
+				for (size_t i(0); i < N; ++i) {
+					double x = gap(i, (double)a[i] - (double)b[i]);
+					s += x * x;
+				}
+				return s;
+			}
+
+		/**
+		 * 分割面の向こう側の点までの距離の2乗の下限
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元
+		 * @param[in]	split	分割面の座標
+		 * @return	距離の2乗の下限
+		 * @note	向こう側は分割面から周期の範囲の端までの区間で、
+					周期の境界を回り込む方が近ければそちらの距離を使う。
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				double q = (double)query[d];
+				double x = std::fabs(q - (double)split);
+				if (0.0 < length[d]) {
+					double e = q < (double)split ? lower[d] + length[d] : lower[d];	// 向こう側の区間の端
+					x = std::min(gap(d, x), gap(d, q - e));
+				}
+				return x * x;
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				return bound - old + now;
+			}
+
+		/**
+		 * 実距離から順位付け用の値への変換
+		 * @param[in]	r	実距離
+		 * @return	順位付け用の値
+		 */
+		double
+		rank(double r) const
+			{
+				return r * r;
+			}
+
+		/**
+		 * 順位付け用の値から実距離への変換
+		 * @param[in]	key	順位付け用の値
+		 * @return	実距離
+		 */
+		double
+		unrank(double key) const
+			{
+				return std::sqrt(key);
+			}
+	};
+
+	/**
+	 * 大円距離 (haversine)
+	 * @note	座標は (緯度, 経度) の度数 (経度は -180 以上 180 以下)。
+				順位付け用の値は haversine (sin^2(中心角 / 2))、実距離は半径 @a radius の球面上の距離。
+	 */
+	template<typename TYPE, size_t N>
+	struct KDHaversine
+	{
+		static_assert(N == 2, "KDHaversine requires (latitude, longitude) points.");
+
+		double radius;	///< 球の半径 (既定値は地球の平均半径 [m])
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	radius	球の半径
+		 */
+		explicit KDHaversine(double radius = 6371008.8)
+			: radius(radius)
+			{
+				;
+			}
+
+		/**
+		 * 度からラジアンへの変換
+		 * @param[in]	degree	度
+		 * @return	ラジアン
+		 */
+		static double
+		Radian(double degree)
+			{
+				return degree * 0.017453292519943295;
+			}
+
+		/**
+		 * 2点間の haversine
+		 * @param[in]	a	点
+		 * @param[in]	b	点
+		 * @return	sin^2(中心角 / 2)
+		 */
+		double
+		distance(const std::array<TYPE, N>& a,
+				 const std::array<TYPE, N>& b) const
+			{
+				double y = std::sin(Radian((double)a[0] - (double)b[0]) / 2.0);
+				double x = std::sin(Radian((double)a[1] - (double)b[1]) / 2.0);
+				double h = y * y + std::cos(Radian(a[0])) * std::cos(Radian(b[0])) * x * x;
+				return std::min(1.0, h);
+			}
+
+		/**
+		 * 分割面の向こう側の点までの haversine の下限
+		 * @param[in]	query	探索の中心
+		 * @param[in]	d	次元 (0: 緯度, 1: 経度)
+		 * @param[in]	split	分割面の座標
+		 * @return	sin^2(中心角 / 2) の下限
+		 * @note	経度の分割面は、その子午線を含む大円までの距離を使う。
+					経度 ±180 度をまたいで回り込める場合は下限を0にする。
+		 */
+		double
+		plane(const std::array<TYPE, N>& query,
+			  size_t d,
+			  TYPE split) const
+			{
+				double x = (double)query[d] - (double)split;
+				if (d == 0) {
+					double y = std::sin(Radian(x) / 2.0);
+					return y * y;
+				}
+
+				if ((x < 0.0 && split < 0) || (0.0 < x && 0 < split) || 180.0 <= std::fabs(x)) return 0.0;
+				double s = std::min(1.0, std::cos(Radian(query[0])) * std::fabs(std::sin(Radian(x))));
+				return (1.0 - std::sqrt(1.0 - s * s)) / 2.0;
+			}
+
+		/**
+		 * 部分木までの下限の更新
+		 * @param[in]	bound	部分木までの下限
+		 * @param[in]	old	次元の以前の下限 (使わない)
+		 * @param[in]	now	次元の新しい下限
+		 * @return	更新した下限
+		 */
+		double
+		update(double bound,
+			   double old,
+			   double now) const
+			{
+				(void)old;
+				return std::max(bound, now);
+			}
+
+		/**
+		 * 球面上の距離から haversine への変換
+		 * @param[in]	r	球面上の距離
+		 * @return	sin^2(中心角 / 2)
+		 */
+		double
+		rank(double r) const
+			{
+				double s = std::sin(std::min(r / radius, 3.141592653589793) / 2.0);
+				return s * s;
+			}
+
+		/**
+		 * haversine から球面上の距離への変換
+		 * @param[in]	key	sin^2(中心角 / 2)
+		 * @return	球面上の距離
+		 */
+		double
+		unrank(double key) const
+			{
+				return 2.0 * radius * std::asin(std::sqrt(std::min(1.0, std::max(0.0, key))));
+			}
+	};
+};
+
+#endif	// __KD_METRIC_HPP__
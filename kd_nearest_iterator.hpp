@@ -0,0 +1,200 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_nearest_iterator.hpp
+ * @brief	配列版kD木の点を近い順に少しずつ取り出す反復子
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_NEAREST_ITERATOR_HPP__
+#define	__KD_NEAREST_ITERATOR_HPP__	"kd_nearest_iterator.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <functional>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 配列版kD木の点を近い順に少しずつ取り出す反復子
+	 * @note	部分木 (距離の下限) と点 (距離) を1つの優先度付きキューに入れ、
+				先頭が点になるまで部分木を展開する (distance browsing)。
+				次の点を取り出す時は、それまでの展開の続きから始める。
+				反復中はkD木を変更しないこと。距離 @a METRIC は kd_metric.hpp を参照。
+	 */
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t>, typename METRIC = KDEuclidean<TYPE, N> >
+	class KDNearestIterator
+	{
+	private:
+
+		/**
+		 * キューの要素
+		 */
+		struct Entry
+		{
+			double key;		///< 順位付け用の距離 (部分木の場合はその下限)
+			size_t index;	///< kD木内のインデックス
+			size_t depth;	///< 深さ
+			size_t offsets;	///< @a offsets_ 内の位置 (点の場合は ~0LU)
+
+			/**
+			 * 比較
+			 * @param[in]	other	比較対象
+			 * @return	自身の方が遠ければ true
+			 */
+			bool
+			operator >(const Entry& other) const
+				{
+					return other.key < key;
+				}
+		};
+
+		const KDSearchArray<TYPE, N, ALLOCATOR>& tree_;	///< kD木
+		const std::array<TYPE, N>* values_;		///< データ (0の場合は木の並び順の座標)
+		std::array<TYPE, N> query_;				///< 探索の中心
+		METRIC metric_;							///< 距離
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue_;	///< 展開待ちの部分木と点
+		std::vector<std::array<double, N> > offsets_;	///< 次元別の分割面までの下限 (近い側の子は親と共有する)
+
+		/**
+		 * 部分木の追加
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @param[in]	bound	部分木までの距離の下限
+		 * @param[in]	offsets	次元ごとの分割面までの下限の @a offsets_ 内の位置
+		 * @note	全ての点が削除された部分木は追加しない (KDSearchArray::find と同じ枝刈り)。
+		 */
+		void
+		push(size_t index,
+			 size_t depth,
+			 double bound,
+			 size_t offsets)
+			{
+				if (!tree_.occupied(index)) return;
+
+				Entry e;
+				e.key = bound;
+				e.index = index;
+				e.depth = depth;
+				e.offsets = offsets;
+				queue_.push(e);
+			}
+
+		/**
+		 * 部分木の展開 (根の点と2つの子をキューに入れる)
+		 * @param[in]	entry	部分木
+		 */
+		void
+		expand(const Entry& entry)
+			{
+				const std::array<TYPE, N>& p = tree_.coordinate(values_, entry.index);
+
+				if (!tree_.erased(tree_.at(entry.index))) {
+					Entry e;
+					e.key = metric_.distance(query_, p);
+					e.index = entry.index;
+					e.depth = entry.depth;
+					e.offsets = ~0LU;
+					queue_.push(e);
+				}
+
+				size_t d = entry.depth % N;
+				bool l = query_[d] < p[d];
+				size_t n = entry.index * 2 + (l ? 1 : 2);
+				size_t f = entry.index * 2 + (l ? 2 : 1);
+				push(n, entry.depth + 1, entry.key, entry.offsets);	// 近い側の子の下限は親と同じ
+
+				if (!tree_.occupied(f)) return;
+				double w = metric_.plane(query_, d, p[d]);
+				std::array<double, N> o = offsets_[entry.offsets];
+				double h = metric_.update(entry.key, o[d], w);
+				o[d] = w;
+				offsets_.push_back(o);
+				push(f, entry.depth + 1, h, offsets_.size() - 1);
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	tree	準備済みのkD木
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	metric	距離
+		 */
+		KDNearestIterator(const KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+						  const std::array<TYPE, N>* values,
+						  const std::array<TYPE, N>& query,
+						  const METRIC& metric = METRIC())
+			: tree_(tree), values_(values), query_(query), metric_(metric), queue_(), offsets_()
+			{
+				std::array<double, N> o;
+				o.fill(0.0);
+				offsets_.push_back(o);
+				push(0, 0, 0.0, 0);
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDNearestIterator(const KDNearestIterator<TYPE, N, ALLOCATOR, METRIC>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDNearestIterator&
+		operator =(const KDNearestIterator<TYPE, N, ALLOCATOR, METRIC>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDNearestIterator()
+			{
+				;
+			}
+
+		/**
+		 * 次に近い点の取得
+		 * @param[out]	neighbor	(順位付け用の距離, データ内の点のインデックス) の組
+		 * @return	点があれば true (全ての点を取り出した後は false)
+		 */
+		bool
+		next(std::pair<double, size_t>& neighbor)
+			{
+				while (!queue_.empty()) {
+					Entry e = queue_.top();
+					queue_.pop();
+					if (e.offsets == ~0LU) {
+						neighbor = std::make_pair(e.key, tree_.at(e.index));
+						return true;
+					}
+					expand(e);
+				}
+
+				return false;
+			}
+
+		/**
+		 * 次に近い点の一括取得
+		 * @param[in]	count	取り出す点の数
+		 * @param[out]	neighbors	近い順に並べた (順位付け用の距離, データ内の点のインデックス) の組 (追加する)
+		 * @return	取り出した点の数
+		 */
+		size_t
+		next(size_t count,
+			 std::vector<std::pair<double, size_t> >& neighbors)
+			{
+				std::pair<double, size_t> n;
+				size_t i(0);
+				for (; i < count && next(n); ++i) neighbors.push_back(n);
+
+				return i;
+			}
+	};
+};
+
+#endif	// __KD_NEAREST_ITERATOR_HPP__
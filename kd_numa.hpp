@@ -0,0 +1,401 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_numa.hpp
+ * @brief	巨大ページとNUMAノードを考慮した配列版kD木の配置
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_NUMA_HPP__
+#define	__KD_NUMA_HPP__	"kd_numa.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <array>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <type_traits>
+#include <sched.h>
+#include <sys/mman.h>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 巨大ページから確保するアロケータ
+	 * @note	2MB以上の確保は mmap で行い、透過的巨大ページを要求する (MADV_HUGEPAGE)。
+				@a hugetlb が true なら、まず明示的な巨大ページ (MAP_HUGETLB) を試す。
+				2MB未満の確保は通常の operator new で行う。
+	 */
+	template<typename T>
+	class KDHugePageAllocator
+	{
+	public:
+
+		typedef T value_type;	///< 要素の型
+
+		static const size_t PAGE = (size_t)2 << 20;	///< 巨大ページのバイト数
+
+		bool hugetlb;	///< 明示的な巨大ページを試すなら true
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	hugetlb	明示的な巨大ページを試すなら true
+		 */
+		explicit KDHugePageAllocator(bool hugetlb = false)
+			: hugetlb(hugetlb)
+			{
+				;
+			}
+
+		/**
+		 * 異なる要素型のアロケータからの変換
+		 * @param[in]	other	アロケータ
+		 */
+		template<typename U>
+		KDHugePageAllocator(const KDHugePageAllocator<U>& other)
+			: hugetlb(other.hugetlb)
+			{
+				;
+			}
+
+		/**
+		 * 領域の確保
+		 * @param[in]	n	要素数
+		 * @return	確保した領域
+		 */
+		T*
+		allocate(size_t n)
+			{
+				size_t s = sizeof(T) * n;
+				if (s < PAGE) return static_cast<T*>(::operator new(s));
+
+				s = (s + PAGE - 1) / PAGE * PAGE;
+				void* p(MAP_FAILED);
+#ifdef	MAP_HUGETLB
+				if (hugetlb) p = ::mmap(0, s, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif	// MAP_HUGETLB
+				if (p == MAP_FAILED) {
+					p = ::mmap(0, s, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef	MADV_HUGEPAGE
+					::madvise(p, s, MADV_HUGEPAGE);
+#endif	// MADV_HUGEPAGE
+				}
+
+				return static_cast<T*>(p);
+			}
+
+		/**
+		 * 領域の解放
+		 * @param[in]	p	@a allocate で確保した領域
+		 * @param[in]	n	要素数
+		 */
+		void
+		deallocate(T* p,
+				   size_t n)
+			{
+				size_t s = sizeof(T) * n;
+				if (s < PAGE) {
+					::operator delete(p);
+					return;
+				}
+
+				::munmap(p, (s + PAGE - 1) / PAGE * PAGE);
+			}
+	};
+
+	/**
+	 * アロケータの比較
+	 * @return	常に true (どのインスタンスで確保した領域も解放できる)
+	 */
+	template<typename T, typename U>
+	inline bool
+	operator ==(const KDHugePageAllocator<T>&,
+				const KDHugePageAllocator<U>&)
+	{
+		return true;
+	}
+
+	/**
+	 * アロケータの比較
+	 * @return	常に false
+	 */
+	template<typename T, typename U>
+	inline bool
+	operator !=(const KDHugePageAllocator<T>&,
+				const KDHugePageAllocator<U>&)
+	{
+		return false;
+	}
+
+	/**
+	 * NUMAノードごとに複製した配列版kD木
+	 * @note	ノードごとに、そのノードのCPUに固定したスレッドでデータを複製して
+				kD木を構築する (ファースト・タッチでノード内のメモリに置かれる)。
+				探索は呼び出したスレッドが動いているノードの複製を使う。
+				ノードの情報が得られない場合は複製を1つだけ作る。
+				呼び出したスレッドのCPUの割り当ては変えない。
+	 */
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t> >
+	class KDNumaReplicas
+	{
+	private:
+
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<std::array<TYPE, N> > ValueAllocator;
+
+		/**
+		 * 複製
+		 */
+		struct Replica
+		{
+			std::vector<std::array<TYPE, N>, ValueAllocator> values;	///< データ
+			KDSearchArray<TYPE, N, ALLOCATOR> tree;	///< kD木
+			std::vector<int> cpus;					///< ノードのCPU
+
+			/**
+			 * コンストラクタ
+			 * @param[in]	allocator	アロケータ
+			 */
+			explicit Replica(const ALLOCATOR& allocator)
+				: values(ValueAllocator(allocator)), tree(allocator), cpus()
+				{
+					;
+				}
+		};
+
+		std::vector<std::unique_ptr<Replica> > replicas_;	///< ノードごとの複製
+		std::vector<size_t> nodes_;			///< CPUからノードへの対応
+
+		/**
+		 * CPUやノードの一覧 ("0-3,8-11" 形式) の解析
+		 * @param[in]	text	CPUやノードの一覧
+		 * @param[out]	cpus	CPUやノードの番号
+		 */
+		static void
+		Parse(const char* text,
+			  std::vector<int>& cpus)
+			{
+				while (*text) {
+					char* e(0);
+					long f = std::strtol(text, &e, 10);
+					if (e == text) break;
+					long t(f);
+					if (*e == '-') t = std::strtol(e + 1, &e, 10);
+					for (long i(f); i <= t; ++i) cpus.push_back((int)i);
+					text = *e == ',' ? e + 1 : e;
+				}
+			}
+
+		/**
+		 * 複製の構築 (ノードのCPUに固定して構築する)
+		 * @param[in,out]	replica	複製
+		 * @param[in]	values	データ
+		 * @param[in]	length	配列 @a values の要素数
+		 * @param[out]	result	成功したら true
+		 * @note	スレッドを作れず呼び出し元のスレッドで構築する場合もあるので、
+					終わったら元のCPUの割り当てに戻す。
+		 */
+		static void
+		Build(Replica* replica,
+			  const std::array<TYPE, N>* values,
+			  size_t length,
+			  bool* result)
+			{
+#ifdef	__linux__
+				cpu_set_t original;
+				bool pinned(false);
+				if (!replica->cpus.empty() && ::sched_getaffinity(0, sizeof(original), &original) == 0) {
+					cpu_set_t set;
+					CPU_ZERO(&set);
+					for (int c : replica->cpus) {
+						if (0 <= c && c < CPU_SETSIZE) CPU_SET(c, &set);
+					}
+					pinned = ::sched_setaffinity(0, sizeof(set), &set) == 0;
+				}
+#endif	// __linux__
+
+				try {
+					replica->values.assign(values, values + length);
+					*result = replica->tree.prepare(replica->values.data(), length);
+				}
+				catch (...) {
+					*result = false;
+				}
+
+#ifdef	__linux__
+				if (pinned) ::sched_setaffinity(0, sizeof(original), &original);
+#endif	// __linux__
+			}
+
+		/**
+		 * ファイルの1行目の読み込み
+		 * @param[in]	path	ファイル・パス
+		 * @param[out]	text	読み込んだ行
+		 * @param[in]	size	配列 @a text の要素数
+		 * @return	成功したら true
+		 */
+		static bool
+		Read(const char* path,
+			 char* text,
+			 size_t size)
+			{
+				std::FILE* file = std::fopen(path, "r");
+				if (!file) return false;
+
+				bool f = std::fgets(text, (int)size, file) != 0;
+				std::fclose(file);
+
+				return f;
+			}
+
+		/**
+		 * 呼び出したスレッドが動いているノードの複製の取得
+		 * @return	複製
+		 */
+		const Replica&
+		local() const
+			{
+				assert(!replicas_.empty());
+
+#ifdef	__linux__
+				int c = ::sched_getcpu();
+				if (0 <= c && (size_t)c < nodes_.size() && nodes_[c] < replicas_.size()) {
+					return *replicas_[nodes_[c]];
+				}
+#endif	// __linux__
+
+				return *replicas_[0];
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDNumaReplicas()
+			: replicas_(), nodes_()
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDNumaReplicas(const KDNumaReplicas<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDNumaReplicas&
+		operator =(const KDNumaReplicas<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDNumaReplicas()
+			{
+				;
+			}
+
+		/**
+		 * 各ノードへの複製とkD木の準備
+		 * @param[in]	values	データ
+		 * @param[in]	length	配列 @a values の要素数
+		 * @param[in]	allocator	アロケータ (例えば KDHugePageAllocator)
+		 * @return	成功したら true
+		 */
+		bool
+		prepare(const std::array<TYPE, N>* values,
+				size_t length,
+				const ALLOCATOR& allocator = ALLOCATOR())
+			{
+				assert(values);
+				assert(0 < length);
+
+				replicas_.clear();
+				nodes_.clear();
+
+				std::unique_ptr<bool[]> results;
+				std::vector<std::thread> workers;
+				try {
+					// /sys からオンラインのノードと、そのCPUを読む (ノード番号は連続とは限らない)
+					char text[4096] = {0};
+					std::vector<int> online;
+					if (Read("/sys/devices/system/node/online", text, sizeof(text))) Parse(text, online);
+					for (int n : online) {
+						char path[64];
+						std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+						if (!Read(path, text, sizeof(text))) continue;
+
+						replicas_.push_back(std::unique_ptr<Replica>(new Replica(allocator)));
+						Parse(text, replicas_.back()->cpus);
+						for (int c : replicas_.back()->cpus) {
+							if (nodes_.size() <= (size_t)c) nodes_.resize(c + 1, ~0LU);
+							nodes_[c] = replicas_.size() - 1;
+						}
+					}
+					if (replicas_.empty()) replicas_.push_back(std::unique_ptr<Replica>(new Replica(allocator)));
+
+					results.reset(new bool[replicas_.size()]);
+					workers.reserve(replicas_.size());	// 作ったスレッドを格納する時に例外を出さないように
+				}
+				catch (...) {
+					replicas_.clear();
+					nodes_.clear();
+					return false;
+				}
+
+				// 各ノードで並行して構築する
+				for (size_t i(0); i < replicas_.size(); ++i) {
+					results[i] = false;
+					try {
+						workers.push_back(std::thread(Build, replicas_[i].get(), values, length, &results[i]));
+					}
+					catch (...) {
+						Build(replicas_[i].get(), values, length, &results[i]);
+					}
+				}
+				for (auto& w : workers) w.join();
+
+				bool f(true);
+				for (size_t i(0); i < replicas_.size(); ++i) f = f && results[i];
+				if (!f) {
+					replicas_.clear();
+					nodes_.clear();
+				}
+
+				return f;
+			}
+
+		/**
+		 * kD木の探索 (呼び出したスレッドのノードの複製を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points) const
+			{
+				const Replica& r = local();
+				r.tree.find(r.values.data(), from, to, points);
+			}
+
+		/**
+		 * 複製の数の取得
+		 * @return	複製の数 (NUMAノードの数)
+		 */
+		size_t
+		replicas() const
+			{
+				return replicas_.size();
+			}
+	};
+};
+
+#endif	// __KD_NUMA_HPP__
@@ -0,0 +1,537 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_paged_array.hpp
+ * @brief	固定長ページに分割してファイルに置いた配列版kD木
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_PAGED_ARRAY_HPP__
+#define	__KD_PAGED_ARRAY_HPP__	"kd_paged_array.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 固定長ページに分割してファイルに置いた配列版kD木
+	 * @note	高さ @a height_ の部分木を1ページとし、必要なページだけを
+				容量の決まったキャッシュ (クロック方式) に読み込んで探索する。
+				根のページだけ高さ @a top_ (@a height_ 以下) にして、残りの段を全て
+				高さ @a height_ で埋めるので、最後の段に空のページが並ぶことは無い。
+				スレッド・セーフではない。
+	 */
+	template<typename TYPE, size_t N>
+	class KDPagedArray
+	{
+	private:
+
+		/**
+		 * ページ内の節点
+		 */
+		struct Node
+		{
+			uint64_t id;				///< データ内のインデックス (点が無い場合は ~0)
+			std::array<TYPE, N> point;	///< 座標
+		};
+
+		/**
+		 * ページ・ファイルのヘッダ
+		 */
+		struct Header
+		{
+			char magic[8];			///< マジック・ナンバー "KDSPAGED"
+			uint32_t version;		///< フォーマットのバージョン
+			uint32_t dimension;		///< 次元数
+			uint32_t type_size;		///< 座標の要素のバイト数
+			uint32_t height;		///< 1ページの部分木の高さ
+			uint64_t length;		///< 元の配列 @a tree_ の容量
+			uint64_t size;			///< 点の数
+			uint64_t page_size;		///< 1ページのバイト数
+			uint64_t pages;			///< ページ数
+			uint64_t levels;		///< 木の深さ (点のある最も深い段 + 1)
+		};
+
+		int fd_;					///< ページ・ファイル
+		size_t height_;				///< 1ページの部分木の高さ
+		size_t top_;				///< 根のページの部分木の高さ
+		size_t levels_;				///< 木の深さ
+		size_t length_;				///< 元の配列 @a tree_ の容量
+		size_t size_;				///< 点の数
+		size_t page_size_;			///< 1ページのバイト数
+		size_t pages_;				///< ページ数
+		std::vector<char> frames_;	///< キャッシュの本体
+		std::vector<size_t> owner_;	///< 各フレームに載っているページ (空なら ~0LU)
+		std::vector<size_t> pins_;	///< 各フレームの使用数
+		std::vector<bool> referenced_;	///< 各フレームの参照ビット
+		std::unordered_map<size_t, size_t> table_;	///< ページからフレームへの対応
+		size_t hand_;				///< クロックの針
+		size_t reads_;				///< ファイルから読んだページ数
+		size_t hits_;				///< キャッシュで済んだページ参照数
+
+		/**
+		 * 深さの取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	深さ
+		 */
+		static size_t
+		Level(size_t index)
+			{
+				size_t l(0);
+				while (index + 1 >= ((size_t)2 << l)) ++l;
+				return l;
+			}
+
+		/**
+		 * 根のページの部分木の高さの取得
+		 * @param[in]	levels	木の深さ
+		 * @param[in]	height	1ページの部分木の高さ
+		 * @return	根のページの部分木の高さ (1以上 @a height 以下)
+		 */
+		static size_t
+		Top(size_t levels,
+			size_t height)
+			{
+				return (levels - 1) % height + 1;
+			}
+
+		/**
+		 * ページ数の取得
+		 * @param[in]	levels	木の深さ
+		 * @param[in]	height	1ページの部分木の高さ
+		 * @return	ページ数
+		 */
+		static size_t
+		Pages(size_t levels,
+			  size_t height)
+			{
+				size_t t = Top(levels, height);
+				size_t b = (levels - t) / height;	// 根のページより下の段の数
+
+				return 1 + ((size_t)1 << t) * ((((size_t)1 << (b * height)) - 1) / (((size_t)1 << height) - 1));
+			}
+
+		/**
+		 * ページ番号とページ内の位置の取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @param[in]	level	@a index の深さ
+		 * @param[in]	top	根のページの部分木の高さ
+		 * @param[in]	height	1ページの部分木の高さ
+		 * @param[out]	slot	ページ内の位置
+		 * @return	ページ番号
+		 */
+		static size_t
+		Locate(size_t index,
+			   size_t level,
+			   size_t top,
+			   size_t height,
+			   size_t& slot)
+			{
+				if (level < top) {
+					slot = index;
+					return 0;
+				}
+
+				size_t b = (level - top) / height;
+				size_t r = (level - top) % height;
+				size_t o = index + 1 - ((size_t)1 << level);	// 深さ内の位置
+
+				slot = ((size_t)1 << r) - 1 + (o & (((size_t)1 << r) - 1));
+
+				return 1 + ((size_t)1 << top) * ((((size_t)1 << (b * height)) - 1) / (((size_t)1 << height) - 1)) + (o >> r);
+			}
+
+		/**
+		 * ページのフレームへの読み込み (使用数を1増やす)
+		 * @param[in]	page	ページ番号
+		 * @return	フレーム番号 (失敗したら ~0LU)
+		 */
+		size_t
+		fetch(size_t page)
+			{
+				assert(page < pages_);
+
+				auto it = table_.find(page);
+				if (it != table_.end()) {
+					++hits_;
+					++pins_[it->second];
+					referenced_[it->second] = true;
+					return it->second;
+				}
+
+				// クロック方式で追い出すフレームを選ぶ
+				size_t f(~0LU);
+				for (size_t i(0); i < owner_.size() * 2; ++i) {
+					size_t h = hand_;
+					hand_ = (hand_ + 1) % owner_.size();
+					if (pins_[h]) continue;
+					if (referenced_[h]) {
+						referenced_[h] = false;
+						continue;
+					}
+					f = h;
+					break;
+				}
+				if (f == ~0LU) return ~0LU;
+
+				if (owner_[f] != ~0LU) table_.erase(owner_[f]);
+				owner_[f] = ~0LU;
+
+				char* p = frames_.data() + page_size_ * f;
+				size_t s(page_size_);
+				off_t o = (off_t)(page_size_ * (page + 1));
+				while (0 < s) {
+					ssize_t r = ::pread(fd_, p, s, o);
+					if (r <= 0) return ~0LU;
+					p += r;
+					s -= (size_t)r;
+					o += r;
+				}
+
+				++reads_;
+				owner_[f] = page;
+				table_[page] = f;
+				pins_[f] = 1;
+				referenced_[f] = true;
+
+				return f;
+			}
+
+		/**
+		 * ページ内の探索
+		 * @param[in]	nodes	ページ内の節点
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @param[in]	index	kD木内での探索対象のインデックス
+		 * @param[in]	level	kD木内での探索対象の深さ
+		 * @param[in]	slot	ページ内での探索対象の位置
+		 * @return	成功したら true
+		 */
+		bool
+		find(const Node* nodes,
+			 const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points,
+			 size_t index,
+			 size_t level,
+			 size_t slot)
+			{
+				const Node& x = nodes[slot];
+				if (x.id == ~(uint64_t)0) return true;
+
+				bool f(true);
+				for (size_t i(0); i < N && f; ++i) {
+					f = (from[i] <= x.point[i]) & (x.point[i] <= to[i]);
+				}
+				if (f) points.push_back((size_t)x.id);
+
+				size_t d = level % N;
+				bool c[2] = {from[d] <= x.point[d], x.point[d] <= to[d]};
+				bool r = top_ <= level + 1 && (level + 1 - top_) % height_ == 0;	// 子が次のページにあるか?
+
+				for (size_t i(0); i < 2; ++i) {
+					size_t k = index * 2 + 1 + i;
+					if (!c[i] || length_ <= k || levels_ <= level + 1) continue;
+					if (r) {
+						if (!find(from, to, points, k, level + 1)) return false;
+					}
+					else {
+						if (!find(nodes, from, to, points, k, level + 1, slot * 2 + 1 + i)) return false;
+					}
+				}
+
+				return true;
+			}
+
+		/**
+		 * ページを読み込んでからの探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @param[in]	index	kD木内での探索対象のインデックス (ページの根)
+		 * @param[in]	level	kD木内での探索対象の深さ
+		 * @return	成功したら true
+		 */
+		bool
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points,
+			 size_t index,
+			 size_t level)
+			{
+				size_t s;
+				size_t p = Locate(index, level, top_, height_, s);
+				size_t f = fetch(p);
+				if (f == ~0LU) return false;
+
+				const Node* nodes = reinterpret_cast<const Node*>(frames_.data() + page_size_ * f);
+				bool r = find(nodes, from, to, points, index, level, s);
+				--pins_[f];
+
+				return r;
+			}
+
+		/**
+		 * ファイルの解放
+		 */
+		void
+		clear()
+			{
+				if (0 <= fd_) ::close(fd_);
+				fd_ = -1;
+				frames_.clear();
+				owner_.clear();
+				pins_.clear();
+				referenced_.clear();
+				table_.clear();
+				hand_ = 0;
+				pages_ = 0;
+				top_ = 0;
+				levels_ = 0;
+				length_ = 0;
+				size_ = 0;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDPagedArray()
+			: fd_(-1), height_(0), top_(0), levels_(0), length_(0), size_(0), page_size_(0), pages_(0),
+			  frames_(), owner_(), pins_(), referenced_(), table_(),
+			  hand_(0), reads_(0), hits_(0)
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDPagedArray(const KDPagedArray<TYPE, N>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDPagedArray&
+		operator =(const KDPagedArray<TYPE, N>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDPagedArray()
+			{
+				clear();
+			}
+
+		/**
+		 * ページ・ファイルの書き出し
+		 * @param[in]	path	保存先のファイル・パス
+		 * @param[in]	tree	準備済みのkD木
+		 * @param[in]	values	データ (0の場合は @a tree のマップした座標を使う)
+		 * @param[in]	page_size	1ページのバイト数 (4096の倍数)
+		 * @return	成功したら true
+		 */
+		template<typename ALLOCATOR>
+		static bool
+		Save(const char* path,
+			 const KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+			 const std::array<TYPE, N>* values,
+			 size_t page_size = 4096)
+			{
+				assert(path);
+				assert(0 < tree.capacity());
+
+				size_t height(1);
+				while ((((size_t)2 << height) - 1) * sizeof(Node) <= page_size) ++height;
+				if (page_size % 4096 != 0 || page_size < sizeof(Header) ||
+					(((size_t)1 << height) - 1) * sizeof(Node) > page_size) return false;
+
+				// 容量ではなく、点のある最も深い段までをページにする
+				size_t l = tree.capacity();
+				size_t levels(1);
+				for (size_t i(l); 0 < i; --i) {
+					if (tree.at(i - 1) == ~0LU) continue;
+					levels = Level(i - 1) + 1;
+					break;
+				}
+				size_t top = Top(levels, height);
+				size_t bands = (levels - top) / height;
+				size_t pages = Pages(levels, height);
+
+				Header header;
+				std::memset(&header, 0, sizeof(header));
+				std::memcpy(header.magic, "KDSPAGED", 8);
+				header.version = 2;
+				header.dimension = (uint32_t)N;
+				header.type_size = (uint32_t)sizeof(TYPE);
+				header.height = (uint32_t)height;
+				header.levels = levels;
+				header.length = l;
+				header.size = tree.size();
+				header.page_size = page_size;
+				header.pages = pages;
+
+				std::FILE* file = std::fopen(path, "wb");
+				if (!file) return false;
+
+				std::vector<char> buffer(page_size, 0);
+				std::memcpy(buffer.data(), &header, sizeof(header));
+				bool f = std::fwrite(buffer.data(), page_size, 1, file) == 1;
+
+				// ページ番号の順に、ページの根から幅優先で節点を並べる (根のページは高さ @a top)
+				Node* nodes = reinterpret_cast<Node*>(buffer.data());
+				for (size_t b(0); f && b <= bands; ++b) {
+					size_t e = b == 0 ? 0 : top + (b - 1) * height;	// ページの根の深さ
+					size_t w = (size_t)1 << e;
+					size_t n = ((size_t)1 << (b == 0 ? top : height)) - 1;
+					for (size_t q(0); f && q < w; ++q) {
+						std::fill(buffer.begin(), buffer.end(), 0);
+						for (size_t s(0); s < n; ++s) {
+							size_t r = Level(s);
+							size_t g = ((size_t)1 << (e + r)) - 1 + (q << r) + (s + 1 - ((size_t)1 << r));
+							nodes[s].id = ~(uint64_t)0;
+							if (l <= g || tree.at(g) == ~0LU) continue;
+							nodes[s].id = tree.at(g);
+							nodes[s].point = tree.coordinate(values, g);
+						}
+						f = std::fwrite(buffer.data(), page_size, 1, file) == 1;
+					}
+				}
+
+				f = (std::fclose(file) == 0) && f;
+				if (!f) std::remove(path);
+
+				return f;
+			}
+
+		/**
+		 * ページ・ファイルを開く
+		 * @param[in]	path	@a Save で保存したファイル・パス
+		 * @param[in]	cache_size	ページ・キャッシュのバイト数
+		 * @return	成功したら true
+		 */
+		bool
+		open(const char* path,
+			 size_t cache_size)
+			{
+				assert(path);
+
+				clear();
+
+				fd_ = ::open(path, O_RDONLY);
+				if (fd_ < 0) return false;
+
+				Header header;
+				if (::pread(fd_, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+					std::memcmp(header.magic, "KDSPAGED", 8) != 0 ||
+					header.version != 2 ||
+					header.dimension != (uint32_t)N ||
+					header.type_size != (uint32_t)sizeof(TYPE) ||
+					header.height == 0 ||
+					header.page_size == 0 ||
+					header.length == 0 ||
+					header.levels == 0 ||
+					header.levels > Level(header.length - 1) + 1 ||
+					header.pages != Pages(header.levels, header.height)) {
+					clear();
+					return false;
+				}
+
+				height_ = header.height;
+				length_ = header.length;
+				size_ = header.size;
+				page_size_ = header.page_size;
+				pages_ = header.pages;
+				levels_ = header.levels;
+				top_ = Top(levels_, height_);
+
+				// 根から葉までのページを同時に固定できるだけのフレームを用意する
+				size_t bands = 1 + (header.levels - top_) / height_;
+				size_t frames = std::max(cache_size / page_size_, bands + 1);
+
+				try {
+					frames_.resize(page_size_ * frames);
+					owner_.assign(frames, ~0LU);
+					pins_.assign(frames, 0);
+					referenced_.assign(frames, false);
+				}
+				catch (...) {
+					clear();
+					return false;
+				}
+
+				return true;
+			}
+
+		/**
+		 * kD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @return	成功したら true (ページの読み込みに失敗したら false)
+		 */
+		bool
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points)
+			{
+				assert(0 <= fd_);
+
+				return find(from, to, points, 0, 0);
+			}
+
+		/**
+		 * 点の数の取得
+		 * @return	点の数
+		 */
+		size_t
+		size() const
+			{
+				return size_;
+			}
+
+		/**
+		 * ファイルから読んだページ数の取得
+		 * @return	ページ数
+		 */
+		size_t
+		reads() const
+			{
+				return reads_;
+			}
+
+		/**
+		 * キャッシュで済んだページ参照数の取得
+		 * @return	ページ参照数
+		 */
+		size_t
+		hits() const
+			{
+				return hits_;
+			}
+
+		/**
+		 * ページ読み込みの計数のリセット
+		 */
+		void
+		reset()
+			{
+				reads_ = 0;
+				hits_ = 0;
+			}
+	};
+};
+
+#endif	// __KD_PAGED_ARRAY_HPP__
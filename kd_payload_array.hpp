@@ -0,0 +1,267 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_payload_array.hpp
+ * @brief	点ごとの付加情報を座標と並べて持つ配列版kD木
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_PAYLOAD_ARRAY_HPP__
+#define	__KD_PAYLOAD_ARRAY_HPP__	"kd_payload_array.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 点ごとの付加情報を座標と並べて持つ配列版kD木
+	 * @note	座標を引き取る (@a prepare_owned と同じ) うえで、付加情報 @a PAYLOAD も
+				配列 @a tree_ の並び順に持つ。探索結果の付加情報は連続した領域から読める。
+				@a PAYLOAD はデフォルト構築とコピー代入ができること。
+				付加情報を揃えずに木を変える KDSearchArray の操作 (付加情報無しの @a prepare,
+				@a prepare_owned など) は公開しない。削除と移動は付加情報も一緒に移す。
+	 */
+	template<typename TYPE, size_t N, typename PAYLOAD, typename ALLOCATOR = std::allocator<size_t> >
+	class KDPayloadArray : private KDSearchArray<TYPE, N, ALLOCATOR>
+	{
+	private:
+
+		typedef KDSearchArray<TYPE, N, ALLOCATOR> Base;
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<PAYLOAD> PayloadAllocator;
+		typedef std::vector<PAYLOAD, PayloadAllocator> PayloadVector;
+
+		PayloadVector payloads_;	///< 配列 @a tree_ の並び順の付加情報
+
+	protected:
+
+		/**
+		 * 部分木の再構築で座標を移したことの通知
+		 * @param[in]	sources	移動元の kD木内のインデックス
+		 * @param[in]	targets	移動先の kD木内のインデックス
+		 * @param[in]	length	移動した点の数
+		 * @return	成功したら true
+		 */
+		virtual bool
+		moved(const size_t* sources,
+			  const size_t* targets,
+			  size_t length)
+			{
+				PayloadVector buffer(payloads_.get_allocator());
+				try {
+					buffer.reserve(length);
+				}
+				catch (...) {
+					return false;
+				}
+
+				for (size_t i(0); i < length; ++i) buffer.push_back(payloads_[sources[i]]);
+				for (size_t i(0); i < length; ++i) payloads_[targets[i]] = buffer[i];
+
+				return true;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDPayloadArray()
+			: Base(), payloads_()
+			{
+				;
+			}
+
+		/**
+		 * アロケータを指定するコンストラクタ
+		 * @param[in]	allocator	内部の領域を確保するアロケータ
+		 */
+		explicit KDPayloadArray(const ALLOCATOR& allocator)
+			: Base(allocator), payloads_(PayloadAllocator(allocator))
+			{
+				;
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDPayloadArray(const KDPayloadArray<TYPE, N, PAYLOAD, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDPayloadArray&
+		operator =(const KDPayloadArray<TYPE, N, PAYLOAD, ALLOCATOR>&) = delete;
+
+		/**
+		 * ムーブ・コンストラクタ
+		 * @param[in,out]	other	移動元 (空のkD木になる)
+		 */
+		KDPayloadArray(KDPayloadArray<TYPE, N, PAYLOAD, ALLOCATOR>&& other) noexcept
+			: Base(std::move(other)), payloads_(std::move(other.payloads_))
+			{
+				;
+			}
+
+		/**
+		 * ムーブ代入演算子
+		 * @param[in,out]	other	移動元 (元の内容と入れ替わる)
+		 * @return	自身
+		 */
+		KDPayloadArray&
+		operator =(KDPayloadArray<TYPE, N, PAYLOAD, ALLOCATOR>&& other) noexcept
+			{
+				Base::swap(other);
+				payloads_.swap(other.payloads_);
+				return *this;
+			}
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDPayloadArray()
+			{
+				;
+			}
+
+		/**
+		 * kD木の準備
+		 * @param[in]	values	データ (準備後は不要)
+		 * @param[in]	payloads	各点の付加情報 (準備後は不要)
+		 * @param[in]	length	配列 @a values, @a payloads の要素数
+		 * @return	成功したら true
+		 * @note	付加情報の領域を確保できなければ元の状態のまま、木を作れなければ空になる。
+		 */
+		bool
+		prepare(const std::array<TYPE, N>* values,
+				const PAYLOAD* payloads,
+				size_t length)
+			{
+				assert(payloads);
+
+				PayloadVector buffer(payloads_.get_allocator());
+				try {
+					buffer.resize(Base::Extent(length));	// 木を作り直す前に引き取る座標と同じ範囲を確保する
+				}
+				catch (...) {
+					return false;
+				}
+
+				PayloadVector(payloads_.get_allocator()).swap(payloads_);
+				if (!Base::prepare_owned(values, length)) return false;
+
+				for (size_t i(0); i < buffer.size(); ++i) {
+					if (Base::at(i) < ~0LU) buffer[i] = payloads[Base::at(i)];
+				}
+				payloads_.swap(buffer);
+
+				return true;
+			}
+
+		/**
+		 * kD木の探索 (付加情報のみ)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	payloads	探索範囲内にある点の付加情報
+		 */
+		void
+		find_payloads(const std::array<TYPE, N>& from,
+					  const std::array<TYPE, N>& to,
+					  std::vector<PAYLOAD>& payloads) const
+			{
+				Base::visit(0, from, to, [&] (size_t k) { payloads.push_back(payloads_[k]); });
+			}
+
+		/**
+		 * kD木の探索 (インデックスと付加情報)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @param[out]	payloads	探索範囲内にある点の付加情報 (@a points と同じ並び)
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points,
+			 std::vector<PAYLOAD>& payloads) const
+			{
+				Base::visit(0, from, to, [&] (size_t k) {
+						points.push_back(Base::at(k));
+						payloads.push_back(payloads_[k]);
+					});
+			}
+
+		using Base::find;
+		using Base::find_periodic;
+		using Base::visit;
+		using Base::nearest;
+		using Base::nearest_from;
+		using Base::within;
+		using Base::categorize;
+		using Base::erased;
+		using Base::set_threshold;
+		using Base::reserve;
+		using Base::release;
+		using Base::size;
+		using Base::capacity;
+		using Base::at;
+		using Base::coordinate;
+
+		/**
+		 * 点の削除
+		 * @param[in]	index	削除する点のインデックス
+		 * @return	削除したら true (削除済み・範囲外の場合は false)
+		 * @note	部分木を作り直した場合、付加情報も座標と一緒に移す。
+		 */
+		bool
+		erase(size_t index)
+			{
+				return Base::erase(index);
+			}
+
+		/**
+		 * 削除済みの割合が閾値を超えた全部分木の再構築
+		 * @return	成功したら true
+		 * @note	付加情報も座標と一緒に移す。
+		 */
+		bool
+		compact()
+			{
+				return Base::compact(0);
+			}
+
+		/**
+		 * 点の移動後のkD木の修正
+		 * @param[in]	values	移動後のデータ (点の数と並びは @a prepare の時と同じ)
+		 * @param[out]	rebuilt	作り直した点の数 (0以外の場合)
+		 * @return	成功したら true
+		 * @note	付加情報は点に付いたまま、作り直した部分木の新しい位置に移す。
+		 */
+		bool
+		refit(const std::array<TYPE, N>* values,
+			  size_t* rebuilt = 0)
+			{
+				return Base::refit(values, rebuilt);
+			}
+
+		/**
+		 * 付加情報の取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	付加情報
+		 */
+		const PAYLOAD&
+		payload(size_t index) const
+			{
+				assert(index < payloads_.size());
+				assert(Base::at(index) < ~0LU);
+
+				return payloads_[index];
+			}
+	};
+};
+
+#endif	// __KD_PAYLOAD_ARRAY_HPP__
@@ -0,0 +1,348 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_point_loader.hpp
+ * @brief	kd_search_array.hpp に渡す点データの読み込み
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_POINT_LOADER_HPP__
+#define	__KD_POINT_LOADER_HPP__	"kd_point_loader.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ys
+{
+	/**
+	 * 点データのファイルの読み込み
+	 * @note	ファイルをマップして、KDSearchArray::prepare にそのまま渡せる配列に格納する。
+				CSVはチャンク単位に複数スレッドで解析する。
+				バイナリは解析せず、マップした内容を複数スレッドで配列にコピーするだけ。
+				スレッドを作れない場合は、残りを呼び出したスレッドで処理する。
+	 */
+	template<typename TYPE, size_t N>
+	class KDPointLoader
+	{
+	private:
+
+		/**
+		 * マップしたファイル
+		 */
+		class Mapping
+		{
+		public:
+
+			const char* data;	///< ファイルの内容
+			size_t size;		///< ファイルのバイト数
+
+			/**
+			 * コンストラクタ
+			 * @param[in]	path	ファイル・パス
+			 */
+			explicit Mapping(const char* path)
+				: data(0), size(0)
+				{
+					int fd = ::open(path, O_RDONLY);
+					if (fd < 0) return;
+
+					struct stat st;
+					if (::fstat(fd, &st) == 0 && 0 < st.st_size) {
+						void* m = ::mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+						if (m != MAP_FAILED) {
+							::madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+							data = static_cast<const char*>(m);
+							size = (size_t)st.st_size;
+						}
+					}
+					::close(fd);
+				}
+
+			/**
+			 * コピー・コンストラクタ (使用禁止)
+			 */
+			Mapping(const Mapping&) = delete;
+
+			/**
+			 * 代入演算子 (使用禁止)
+			 */
+			Mapping&
+			operator =(const Mapping&) = delete;
+
+			/**
+			 * デストラクタ
+			 */
+			~Mapping()
+				{
+					if (data) ::munmap(const_cast<char*>(data), size);
+				}
+		};
+
+		/**
+		 * スレッド数の決定
+		 * @param[in]	threads	指定されたスレッド数 (0なら自動)
+		 * @param[in]	size	処理するバイト数
+		 * @return	スレッド数
+		 */
+		static size_t
+		Threads(size_t threads,
+				size_t size)
+			{
+				if (threads == 0) threads = std::thread::hardware_concurrency();
+				if (threads == 0) threads = 1;
+
+				size_t m = size / (1 << 20) + 1;	// 1チャンクは最低1MB
+				return threads < m ? threads : m;
+			}
+
+		/**
+		 * 数値の解析
+		 * @param[in]	p	文字列の始点
+		 * @param[in]	e	文字列の終点
+		 * @param[out]	value	解析した値
+		 * @return	成功したら true
+		 */
+		static bool
+		Parse(const char* p,
+			  const char* e,
+			  TYPE& value)
+			{
+				char buffer[64];
+				while (p < e && (*p == ' ' || *p == '\t')) ++p;
+				while (p < e && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) --e;
+				if (p == e || (size_t)(e - p) >= sizeof(buffer)) return false;
+
+				std::memcpy(buffer, p, e - p);
+				buffer[e - p] = '\0';
+
+				char* end(0);
+				if (std::is_floating_point<TYPE>::value) {
+					value = (TYPE)std::strtod(buffer, &end);
+				}
+				else if (std::is_signed<TYPE>::value) {
+					value = (TYPE)std::strtoll(buffer, &end, 10);
+				}
+				else {
+					value = (TYPE)std::strtoull(buffer, &end, 10);
+				}
+
+				return *end == '\0';
+			}
+
+		/**
+		 * CSVのチャンクの解析
+		 * @param[in]	from	チャンクの始点
+		 * @param[in]	to	チャンクの終点
+		 * @param[in]	delimiter	区切り文字
+		 * @param[out]	points	解析した点
+		 * @param[out]	result	成功したら true
+		 */
+		static void
+		ParseCsv(const char* from,
+				 const char* to,
+				 char delimiter,
+				 std::vector<std::array<TYPE, N> >* points,
+				 bool* result)
+			{
+				assert(points);
+				assert(result);
+
+				*result = true;
+				try {
+					points->reserve((to - from) / (N * 2));
+				}
+				catch (...) {
+					*result = false;
+					return;
+				}
+
+				while (from < to) {
+					const char* e = static_cast<const char*>(std::memchr(from, '\n', to - from));
+					if (!e) e = to;
+
+					const char* p(from);
+					while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+					if (p < e) {
+						std::array<TYPE, N> value;
+						for (size_t i(0); i < N; ++i) {
+							const char* q = i + 1 < N ? static_cast<const char*>(std::memchr(p, delimiter, e - p)) : e;
+							if (!q || !Parse(p, q, value[i])) {
+								*result = false;
+								return;
+							}
+							p = q + 1;
+						}
+						try {
+							points->push_back(value);
+						}
+						catch (...) {
+							*result = false;
+							return;
+						}
+					}
+
+					from = e + 1;
+				}
+			}
+
+		/**
+		 * 配列の並列コピー
+		 * @param[out]	output	コピー先
+		 * @param[in]	input	コピー元
+		 * @param[in]	size	コピーするバイト数
+		 * @param[in]	threads	スレッド数
+		 */
+		static void
+		Copy(char* output,
+			 const char* input,
+			 size_t size,
+			 size_t threads)
+			{
+				std::vector<std::thread> workers;
+				size_t s = (size / threads + 4095) & ~(size_t)4095;
+				try {
+					workers.reserve(size / s + 1);	// 作ったスレッドを格納する時に例外を出さないように
+				}
+				catch (...) {
+					std::memcpy(output, input, size);
+					return;
+				}
+
+				for (size_t i(0); i < size; i += s) {
+					size_t l = size - i < s ? size - i : s;
+					try {
+						workers.push_back(std::thread([=] () { std::memcpy(output + i, input + i, l); }));
+					}
+					catch (...) {
+						std::memcpy(output + i, input + i, l);
+					}
+				}
+
+				for (auto& w : workers) w.join();
+			}
+
+	public:
+
+		/**
+		 * 固定長バイナリ・ファイルの読み込み
+		 * @param[in]	path	ファイル・パス (std::array<TYPE, N> をそのまま並べたもの)
+		 * @param[out]	points	読み込んだ点 (末尾に追加する)
+		 * @param[in]	threads	コピーのスレッド数 (0なら自動)
+		 * @return	成功したら true
+		 * @note	解析は無く、マップした内容を並列に memcpy するだけ。
+		 */
+		static bool
+		LoadBinary(const char* path,
+				   std::vector<std::array<TYPE, N> >& points,
+				   size_t threads = 0)
+			{
+				assert(path);
+
+				Mapping m(path);
+				if (!m.data || m.size % sizeof(std::array<TYPE, N>) != 0) return false;
+
+				size_t o = points.size();
+				try {
+					points.resize(o + m.size / sizeof(std::array<TYPE, N>));
+				}
+				catch (...) {
+					return false;
+				}
+
+				Copy(reinterpret_cast<char*>(points.data() + o), m.data, m.size, Threads(threads, m.size));
+
+				return true;
+			}
+
+		/**
+		 * CSVファイルの読み込み
+		 * @param[in]	path	ファイル・パス (1行に1点、N列)
+		 * @param[out]	points	読み込んだ点 (末尾に追加する)
+		 * @param[in]	threads	スレッド数 (0なら自動)
+		 * @param[in]	delimiter	区切り文字
+		 * @param[in]	header	先頭行を読み飛ばすなら true
+		 * @return	成功したら true
+		 */
+		static bool
+		LoadCsv(const char* path,
+				std::vector<std::array<TYPE, N> >& points,
+				size_t threads = 0,
+				char delimiter = ',',
+				bool header = false)
+			{
+				assert(path);
+
+				Mapping m(path);
+				if (!m.data) return false;
+
+				const char* from(m.data);
+				const char* to(m.data + m.size);
+				if (header) {
+					const char* e = static_cast<const char*>(std::memchr(from, '\n', to - from));
+					from = e ? e + 1 : to;
+				}
+
+				// 改行の位置でチャンクに分割
+				size_t t = Threads(threads, to - from);
+				std::vector<const char*> bounds(1, from);
+				for (size_t i(1); i < t; ++i) {
+					const char* p = from + (to - from) * i / t;
+					if (p < bounds.back()) p = bounds.back();
+					const char* e = static_cast<const char*>(std::memchr(p, '\n', to - p));
+					bounds.push_back(e ? e + 1 : to);
+				}
+				bounds.push_back(to);
+
+				std::vector<std::vector<std::array<TYPE, N> > > chunks;
+				std::unique_ptr<bool[]> results;
+				std::vector<std::thread> workers;
+				try {
+					chunks.resize(t);
+					results.reset(new bool[t]);
+					workers.reserve(t);	// 作ったスレッドを格納する時に例外を出さないように
+				}
+				catch (...) {
+					return false;
+				}
+
+				for (size_t i(0); i < t; ++i) {
+					try {
+						workers.push_back(std::thread(ParseCsv, bounds[i], bounds[i+1], delimiter, &chunks[i], &results[i]));
+					}
+					catch (...) {
+						ParseCsv(bounds[i], bounds[i+1], delimiter, &chunks[i], &results[i]);
+					}
+				}
+				for (auto& w : workers) w.join();
+
+				size_t l(points.size());
+				for (size_t i(0); i < t; ++i) {
+					if (!results[i]) return false;
+					l += chunks[i].size();
+				}
+
+				try {
+					points.reserve(l);
+					for (size_t i(0); i < t; ++i) {
+						points.insert(points.end(), chunks[i].begin(), chunks[i].end());
+					}
+				}
+				catch (...) {
+					return false;
+				}
+
+				return true;
+			}
+	};
+};
+
+#endif	// __KD_POINT_LOADER_HPP__
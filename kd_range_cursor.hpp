@@ -0,0 +1,170 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_range_cursor.hpp
+ * @brief	配列版kD木の範囲探索の結果を少しずつ取り出すカーソル
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_RANGE_CURSOR_HPP__
+#define	__KD_RANGE_CURSOR_HPP__	"kd_range_cursor.hpp"
+
+#include <cassert>
+#include <array>
+#include <vector>
+#include <utility>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 配列版kD木の範囲探索の結果を少しずつ取り出すカーソル
+	 * @note	未探索の部分木を明示的なスタックに持ち、取り出す点が見つかった所で止まる。
+				次の点を取り出す時は、スタックに残った部分木から探索を続ける。
+				スタックの大きさは木の深さ程度なので、結果の数によらずメモリは一定。
+				点は KDSearchArray::find と同じ順 (行きがけ順) に出てくる。
+				反復中はkD木を変更しないこと。
+	 */
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t> >
+	class KDRangeCursor
+	{
+	private:
+
+		const KDSearchArray<TYPE, N, ALLOCATOR>& tree_;	///< kD木
+		const std::array<TYPE, N>* values_;		///< データ (0の場合は木の並び順の座標)
+		std::array<TYPE, N> from_;				///< 探索範囲の始点
+		std::array<TYPE, N> to_;				///< 探索範囲の終点
+		std::vector<std::pair<size_t, size_t> > stack_;	///< 未探索の部分木の (kD木内のインデックス, 深さ)
+
+		/**
+		 * 部分木の追加
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @note	全ての点が削除された部分木は積まない (KDSearchArray::find と同じ枝刈り)。
+		 */
+		void
+		push(size_t index,
+			 size_t depth)
+			{
+				if (!tree_.occupied(index)) return;
+
+				stack_.push_back(std::make_pair(index, depth));
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 * @param[in]	tree	準備済みのkD木
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 */
+		KDRangeCursor(const KDSearchArray<TYPE, N, ALLOCATOR>& tree,
+					  const std::array<TYPE, N>* values,
+					  const std::array<TYPE, N>& from,
+					  const std::array<TYPE, N>& to)
+			: tree_(tree), values_(values), from_(from), to_(to), stack_()
+			{
+				push(0, 0);
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDRangeCursor(const KDRangeCursor<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDRangeCursor&
+		operator =(const KDRangeCursor<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDRangeCursor()
+			{
+				;
+			}
+
+		/**
+		 * 探索範囲の変更 (最初から探索し直す)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 */
+		void
+		reset(const std::array<TYPE, N>& from,
+			  const std::array<TYPE, N>& to)
+			{
+				from_ = from;
+				to_ = to;
+				stack_.clear();
+				push(0, 0);
+			}
+
+		/**
+		 * 次の点の取得
+		 * @param[out]	point	範囲内にある点のデータ内のインデックス
+		 * @return	点があれば true (全ての点を取り出した後は false)
+		 */
+		bool
+		next(size_t& point)
+			{
+				while (!stack_.empty()) {
+					size_t index = stack_.back().first;
+					size_t depth = stack_.back().second;
+					stack_.pop_back();
+
+					const std::array<TYPE, N>& p = tree_.coordinate(values_, index);
+					size_t d = depth % N;
+
+					// 左の子を先に取り出すよう、右の子から積む
+					if (p[d] <= to_[d]) push(index * 2 + 2, depth + 1);
+					if (from_[d] <= p[d]) push(index * 2 + 1, depth + 1);
+
+					bool f(true);
+					for (size_t i(0); i < N && f; ++i) {
+						f = (from_[i] <= p[i]) & (p[i] <= to_[i]);
+					}
+
+					if (f && !tree_.erased(tree_.at(index))) {
+						point = tree_.at(index);
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+		/**
+		 * 次の点の一括取得 (1ページ分)
+		 * @param[in]	count	取り出す点の数
+		 * @param[out]	points	範囲内にある点のデータ内のインデックス (追加する)
+		 * @return	取り出した点の数 (@a count 未満なら全ての点を取り出した)
+		 */
+		size_t
+		next(size_t count,
+			 std::vector<size_t>& points)
+			{
+				size_t p;
+				size_t i(0);
+				for (; i < count && next(p); ++i) points.push_back(p);
+
+				return i;
+			}
+
+		/**
+		 * 全ての点を取り出したかの判定
+		 * @return	未探索の部分木が残っていなければ true
+		 * @note	false でも、残りの部分木に範囲内の点が無い場合がある。
+		 */
+		bool
+		done() const
+			{
+				return stack_.empty();
+			}
+	};
+};
+
+#endif	// __KD_RANGE_CURSOR_HPP__
@@ -15,9 +15,15 @@
 //#define	__KD_SEARCH_ARRAY_USE_SELECTION__	1
 
 #include <cassert>
+#include <cstdint>
 #include <array>
 #include <vector>
+#include <memory>
+#include <limits>
+#include <utility>
 #include <algorithm>
+#include <functional>
+#include "kd_metric.hpp"
 
 #ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
 #include <random>
@@ -25,16 +31,48 @@
 
 namespace ys
 {
+	template<typename TYPE, size_t N, typename ALLOCATOR>
+	class KDMappedImage;
+
 	/**
 	 * 要素の追加・削除をしない配列版kD木
+	 * @note	削除は @a erase による論理削除のみ。削除済みの割合が閾値を超えた部分木は作り直す。
+				内部の領域は全てアロケータ @a ALLOCATOR (size_t 等に rebind して使う) から確保する。
 	 */
-	template<typename TYPE, size_t N>
+	template<typename TYPE, size_t N, typename ALLOCATOR = std::allocator<size_t> >
 	class KDSearchArray
 	{
 	private:
 
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<size_t> IndexAllocator;
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<uint64_t> BitAllocator;
+		typedef std::allocator_traits<IndexAllocator> IndexTraits;
+		typedef std::vector<size_t, IndexAllocator> IndexVector;
+		typedef std::vector<uint64_t, BitAllocator> BitVector;
+		typedef typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<std::array<TYPE, N> > PointAllocator;
+		typedef std::vector<std::array<TYPE, N>, PointAllocator> PointVector;
+
+		friend class KDMappedImage<TYPE, N, ALLOCATOR>;
+
+		IndexAllocator allocator_;	///< アロケータ
 		size_t* tree_;		///< kD木の本体
 		size_t length_;		///< 配列 @a tree_ の容量
+		size_t size_;		///< 点の数
+		const std::array<TYPE, N>* points_;	///< 配列 @a tree_ の並び順の座標 (無ければ0)
+		PointVector owned_;	///< 引き取った座標 (配列 @a tree_ の並び順、引き取っていなければ空)
+		void* mapping_;		///< マップしたファイル・イメージ (無ければ0)
+		size_t mapping_size_;	///< マップしたファイル・イメージのバイト数
+		void (*unmap_)(void*, size_t);	///< マップしたファイル・イメージの解放 (kd_mapped_image.hpp)
+		size_t* buffer_;	///< 構築用の作業領域
+		size_t buffer_length_;	///< 配列 @a buffer_ の容量
+		bool keep_;			///< 作業領域を構築後も残すなら true (@a reserve で指定)
+		BitVector dead_;	///< 削除済みの点のビットマップ (削除が無ければ空)
+		IndexVector live_;	///< 各部分木の削除されていない点の数 (削除が無ければ空)
+		IndexVector count_;	///< 各部分木の点の数 (削除が無ければ空)
+		IndexVector slot_;	///< 各点の kD木内のインデックス (削除が無ければ空)
+		BitVector categories_;	///< 各点の分類のビットマスク (分類が無ければ空)
+		BitVector masks_;	///< 各部分木の分類のビットマスクの論理和 (分類が無ければ空)
+		double threshold_;	///< 部分木を作り直す削除済みの点の割合
 #ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
 		std::mt19937* mt_;	///< メルセンヌ・ツイスタ (32bit版)
 #endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
@@ -86,173 +124,1660 @@ namespace ys
 #endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
 
 		/**
-		 * kD木の構築
-		 * @param[in,out]	buffer	配列 @a values のインデックス (作業領域)
-		 * @param[in]	values	データ
-		 * @param[in]	index	kD木の中で確定させるインデックス
-		 * @param[in]	from	配列 @a buffer の処理領域の始点
-		 * @param[in]	to	配列 @a buffer の処理領域の終点
-		 * @param[in]	depth	kD木の深さ
-		 * @note	以前は選択アルゴリズムを内部的に使っていたが、
-					最悪計算時間が好ましくなかったため、std::stable_sort に置き換えた。
+		 * 内部領域の解放
 		 */
 		void
-		build(size_t* buffer,
-			  const std::array<TYPE, N>* values,
-			  size_t index,
-			  size_t from,
-			  size_t to,
-			  size_t depth)
+		clear()
 			{
-				assert(tree_);
-				assert(buffer);
-				assert(values);
-				assert(from <= to);
+				if (mapping_) {
+					unmap_(mapping_, mapping_size_);
+					mapping_ = 0;
+					mapping_size_ = 0;
+					unmap_ = 0;
+				}
+				else if (tree_) {
+					IndexTraits::deallocate(allocator_, tree_, length_);
+				}
 
-				size_t k = (from + to) / 2;
-				if (from < to) {
-#ifndef	__KD_SEARCH_ARRAY_USE_SELECTION__
-					size_t d = depth % N;
-					std::stable_sort(buffer + from, buffer + to + 1,
-									 [values, d] (size_t l, size_t r) { return values[l][d] <= values[r][d]; });
-#else	// !__KD_SEARCH_ARRAY_USE_SELECTION__
-					Select(buffer, values, k, from, to, depth % N, mt_);
-#endif	// !__KD_SEARCH_ARRAY_USE_SELECTION__
+				tree_ = 0;
+				length_ = 0;
+				size_ = 0;
+				points_ = 0;
+				PointVector(allocator_).swap(owned_);
+				BitVector(allocator_).swap(categories_);
+				BitVector(allocator_).swap(masks_);
+				forget();
+			}
+
+		/**
+		 * 削除の記録の解放
+		 */
+		void
+		forget()
+			{
+				BitVector(allocator_).swap(dead_);
+				IndexVector(allocator_).swap(live_);
+				IndexVector(allocator_).swap(count_);
+				IndexVector(allocator_).swap(slot_);
+			}
+
+		/**
+		 * 作業領域の確保
+		 * @param[in]	length	必要な要素数
+		 * @return	成功したら true
+		 */
+		bool
+		acquire(size_t length)
+			{
+				if (length <= buffer_length_) return true;
+
+				dispose();
+				try {
+					buffer_ = IndexTraits::allocate(allocator_, length);
 				}
-				tree_[index] = buffer[k];
+				catch (...) {
+					return false;
+				}
+				buffer_length_ = length;
 
-				if (from < k) build(buffer, values, index * 2 + 1, from, k - 1, depth + 1);
-				if (k < to) build(buffer, values, index * 2 + 2, k + 1, to, depth + 1);
+				return true;
 			}
 
-	public:
+		/**
+		 * 作業領域の解放
+		 */
+		void
+		dispose()
+			{
+				if (buffer_) IndexTraits::deallocate(allocator_, buffer_, buffer_length_);
+				buffer_ = 0;
+				buffer_length_ = 0;
+			}
 
 		/**
-		 * コンストラクタ
+		 * 構築後の作業領域の後始末
+		 * @note	@a reserve で残すよう指定されていなければ解放する。
 		 */
-		KDSearchArray()
-			: tree_(0), length_(0)
-#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
-			, mt_(0)
-#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+		void
+		recycle()
 			{
-#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
-				std::random_device rd;
-				mt_ = new std::mt19937(rd());
-#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+				if (!keep_) dispose();
 			}
 
 		/**
-		 * コピー・コンストラクタ (使用禁止)
+		 * 深さの取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	深さ
 		 */
-		KDSearchArray(const KDSearchArray<TYPE, N>&) = delete;
+		static size_t
+		Depth(size_t index)
+			{
+				size_t d(0);
+				while (((size_t)2 << d) <= index + 1) ++d;
+				return d;
+			}
 
 		/**
-		 * 代入演算子 (使用禁止)
+		 * 削除済みか否かの判定
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	削除済みなら true
 		 */
-		KDSearchArray&
-		operator =(const KDSearchArray<TYPE, N>&) = delete;
+		bool
+		dead(size_t index) const
+			{
+				size_t x = tree_[index];
+				return !dead_.empty() && (dead_[x / 64] >> (x % 64)) & 1;
+			}
 
 		/**
-		 * デストラクタ
+		 * 部分木の点の数の集計
+		 * @param[in]	index	部分木の根の kD木内のインデックス
 		 */
-		virtual
-		~KDSearchArray()
+		void
+		tally(size_t index)
 			{
-				if (tree_) delete [] tree_;
-#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
-				if (mt_) delete mt_;
-#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+				assert(index < length_);
+
+				if (tree_[index] == ~0LU) {
+					live_[index] = count_[index] = 0;
+					return;
+				}
+
+				slot_[tree_[index]] = index;
+				live_[index] = dead(index) ? 0 : 1;
+				count_[index] = 1;
+
+				for (size_t k(index * 2 + 1); k <= index * 2 + 2 && k < length_; ++k) {
+					tally(k);
+					live_[index] += live_[k];
+					count_[index] += count_[k];
+				}
 			}
 
 		/**
-		 * kD木の準備
+		 * 部分木の分類のビットマスクの取得
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	ビットマスク (部分木が空なら0)
+		 */
+		uint64_t
+		mask(size_t index) const
+			{
+				return index < length_ && tree_[index] < ~0LU ? masks_[index] : 0;
+			}
+
+		/**
+		 * 部分木の分類のビットマスクの集計
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	ビットマスク (部分木が空なら0)
+		 */
+		uint64_t
+		mark(size_t index)
+			{
+				if (length_ <= index || tree_[index] == ~0LU) return 0;
+
+				uint64_t m = categories_[tree_[index]];
+				m |= mark(index * 2 + 1);
+				m |= mark(index * 2 + 2);
+
+				return masks_[index] = m;
+			}
+
+		/**
+		 * 作り直した部分木と祖先の分類のビットマスクの更新
+		 * @param[in]	index	作り直した部分木の根の kD木内のインデックス
+		 */
+		void
+		remark(size_t index)
+			{
+				if (masks_.empty()) return;
+
+				mark(index);
+				for (size_t i(index); 0 < i;) {
+					i = (i - 1) / 2;
+					masks_[i] = categories_[tree_[i]] | mask(i * 2 + 1) | mask(i * 2 + 2);
+				}
+			}
+
+		/**
+		 * 部分木の点の収集と消去
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[out]	buffer	収集した点のインデックス (十分な容量があること)
+		 * @param[in,out]	length	配列 @a buffer に収集済みの要素数
+		 * @param[in]	purge	削除済みの点を捨てるなら true
+		 */
+		void
+		collect(size_t index,
+				size_t* buffer,
+				size_t& length,
+				bool purge)
+			{
+				if (length_ <= index || tree_[index] == ~0LU) return;
+
+				if (purge && dead(index)) slot_[tree_[index]] = ~0LU;
+				else buffer[length++] = tree_[index];
+				tree_[index] = ~0LU;
+
+				collect(index * 2 + 1, buffer, length, purge);
+				collect(index * 2 + 2, buffer, length, purge);
+			}
+
+		/**
+		 * 部分木の点の数の取得
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	削除済みの点を含む点の数
+		 */
+		size_t
+		population(size_t index) const
+			{
+				if (length_ <= index || tree_[index] == ~0LU) return 0;
+				if (!count_.empty()) return count_[index];
+
+				return 1 + population(index * 2 + 1) + population(index * 2 + 2);
+			}
+
+		/**
+		 * 削除済みの点を除いた部分木の再構築
 		 * @param[in]	values	データ
-		 * @param[in]	length	配列 @a values の要素数
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	成功したら true
+		 * @note	点が減るだけなので、部分木は元の部分木の領域に収まる。
 		 */
 		bool
-		prepare(const std::array<TYPE, N>* values,
-				size_t length)
+		rebuild(const std::array<TYPE, N>* values,
+				size_t index)
 			{
-				assert(values);
-				assert(0 < length);
-				assert(length < ~0LU);
+				assert(values || !owned_.empty());
+				assert(!live_.empty());
 
-				size_t* buffer(0);
-				size_t l(1);
-				while (l < length) l *= 2;
+				size_t c = count_[index] - live_[index];
+				if (owned_.empty()) {
+					if (!acquire(live_[index])) return false;
+					size_t m(0);
+					collect(index, buffer_, m, true);
+					if (0 < m) build(buffer_, values, index, 0, m - 1, Depth(index));
+					recycle();
+				}
+				else if (!relocate(index, true)) {
+					return false;
+				}
+				tally(index);
+				remark(index);
+
+				for (size_t i(index); 0 < i;) {
+					i = (i - 1) / 2;
+					count_[i] -= c;
+				}
+
+				return true;
+			}
+
+		/**
+		 * 引き取った座標ごとの部分木の点の収集と消去
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[out]	points	収集した点の座標 (十分な容量があること)
+		 * @param[out]	ids	収集した点のインデックス (十分な容量があること)
+		 * @param[out]	sources	収集した点の kD木内のインデックス (十分な容量があること)
+		 * @param[in]	purge	削除済みの点を捨てるなら true
+		 */
+		void
+		gather(size_t index,
+			   PointVector& points,
+			   IndexVector& ids,
+			   IndexVector& sources,
+			   bool purge)
+			{
+				if (length_ <= index || tree_[index] == ~0LU) return;
 
-				if (tree_) {
-					delete [] tree_;
-					tree_ = 0;
+				if (purge && dead(index)) {
+					slot_[tree_[index]] = ~0LU;
 				}
+				else {
+					ids.push_back(tree_[index]);
+					points.push_back(owned_[index]);
+					sources.push_back(index);
+				}
+				tree_[index] = ~0LU;
+
+				gather(index * 2 + 1, points, ids, sources, purge);
+				gather(index * 2 + 2, points, ids, sources, purge);
+			}
+
+		/**
+		 * 局所的なインデックスで構築した部分木の座標とインデックスの確定
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	points	@a gather で収集した座標
+		 * @param[in]	ids	@a gather で収集したインデックス
+		 * @param[out]	targets	各点の移動先の kD木内のインデックス
+		 */
+		void
+		settle(size_t index,
+			   const PointVector& points,
+			   const IndexVector& ids,
+			   IndexVector& targets)
+			{
+				if (length_ <= index || tree_[index] == ~0LU) return;
+
+				size_t j = tree_[index];
+				owned_[index] = points[j];
+				tree_[index] = ids[j];
+				targets[j] = index;
+
+				settle(index * 2 + 1, points, ids, targets);
+				settle(index * 2 + 2, points, ids, targets);
+			}
+
+		/**
+		 * 引き取った座標での部分木の再構築
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	purge	削除済みの点を捨てるなら true
+		 * @return	成功したら true
+		 * @note	引き取った座標は木の並び順なので、部分木の点を取り出して局所的に作り直す。
+		 */
+		bool
+		relocate(size_t index,
+				 bool purge)
+			{
+				assert(!owned_.empty());
 
+				size_t m = population(index);
+				PointVector points(allocator_);
+				IndexVector ids(allocator_);
+				IndexVector sources(allocator_);
+				IndexVector targets(allocator_);
 				try {
-					tree_ = new size_t[l];
-					buffer = new size_t[length];
+					points.reserve(m);
+					ids.reserve(m);
+					sources.reserve(m);
+					targets.resize(m);
 				}
 				catch (...) {
-					;
+					return false;
 				}
+				if (!acquire(m)) return false;
 
-				if (!tree_ || !buffer) {
-					if (tree_) delete [] tree_;
-					if (buffer) delete [] buffer;
-					return false;
+				gather(index, points, ids, sources, purge);
+				for (size_t i(0); i < ids.size(); ++i) buffer_[i] = i;
+				if (!ids.empty()) build(buffer_, points.data(), index, 0, ids.size() - 1, Depth(index));
+				recycle();
+				settle(index, points, ids, targets);
+
+				return moved(sources.data(), targets.data(), ids.size());
+			}
+
+		/**
+		 * 削除済みの割合が閾値を超えているか否かの判定
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	超えていれば true
+		 */
+		bool
+		sparse(size_t index) const
+			{
+				return 0 < count_[index] && threshold_ * count_[index] < count_[index] - live_[index];
+			}
+
+		/**
+		 * 閾値を超えた部分木の再構築
+		 * @param[in]	values	データ
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	成功したら true
+		 */
+		bool
+		compact(const std::array<TYPE, N>* values,
+				size_t index)
+			{
+				if (length_ <= index || count_[index] == live_[index]) return true;
+				if (sparse(index)) return rebuild(values, index);
+
+				return compact(values, index * 2 + 1) && compact(values, index * 2 + 2);
+			}
+
+		/**
+		 * 分割の条件の検証
+		 * @param[in]	values	移動後のデータ
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @param[out]	lower	部分木の包含矩形の下限
+		 * @param[out]	upper	部分木の包含矩形の上限
+		 * @param[out]	roots	条件が破れた部分木のうち最も上の部分木の根 (追加する)
+		 * @note	部分木の包含矩形は部分木内の並びに依らないので、検証は作り直す前に済ませられる。
+		 */
+		void
+		validate(const std::array<TYPE, N>* values,
+				 size_t index,
+				 size_t depth,
+				 std::array<TYPE, N>& lower,
+				 std::array<TYPE, N>& upper,
+				 IndexVector& roots) const
+			{
+				assert(index < length_);
+				assert(tree_[index] < ~0LU);
+
+				const std::array<TYPE, N>& p = values[tree_[index]];
+				lower = upper = p;
+
+				size_t m = roots.size();
+				size_t d = depth % N;
+				bool f(true);
+				for (size_t i(0); i < 2; ++i) {
+					size_t k = index * 2 + 1 + i;
+					if (length_ <= k || tree_[k] == ~0LU) continue;
+
+					std::array<TYPE, N> l, u;
+					validate(values, k, depth + 1, l, u, roots);
+					f = f && (i == 0 ? u[d] <= p[d] : p[d] <= l[d]);
+					for (size_t j(0); j < N; ++j) {
+						if (l[j] < lower[j]) lower[j] = l[j];
+						if (upper[j] < u[j]) upper[j] = u[j];
+					}
 				}
 
-				std::fill(tree_, tree_ + l, ~0LU);
-				for (size_t i(0); i < length; ++i) buffer[i] = i;
-				build(buffer, values, 0, 0, length - 1, 0);
-				length_ = l;
-				delete [] buffer;
+				if (f) return;
 
-				return true;
+				roots.resize(m);	// 子孫の部分木はまとめて作り直す
+				roots.push_back(index);
 			}
 
 		/**
-		 * kD木の探索
+		 * 同じ点の集合での部分木の再構築
+		 * @param[in]	values	データ (座標を引き取った場合は使わない)
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	作り直した点の数 (失敗したら0)
+		 * @note	削除による縮小で部分木の形は崩れ得るので、一度消去してから作り直す。
+		 */
+		size_t
+		reshape(const std::array<TYPE, N>* values,
+				size_t index)
+			{
+				size_t m(0);
+				if (owned_.empty()) {
+					if (!acquire(population(index))) return 0;
+					collect(index, buffer_, m, false);
+					build(buffer_, values, index, 0, m - 1, Depth(index));
+					recycle();
+				}
+				else {
+					m = population(index);
+					if (!relocate(index, false)) return 0;
+				}
+				if (!live_.empty()) tally(index);
+				remark(index);
+
+				return m;
+			}
+
+		/**
+		 * kD木の構築
+		 * @param[in,out]	buffer	配列 @a values のインデックス (作業領域)
 		 * @param[in]	values	データ
+		 * @param[in]	index	kD木の中で確定させるインデックス
+		 * @param[in]	from	配列 @a buffer の処理領域の始点
+		 * @param[in]	to	配列 @a buffer の処理領域の終点
+		 * @param[in]	depth	kD木の深さ
+		 * @note	以前は選択アルゴリズムを内部的に使っていたが、
+					最悪計算時間が好ましくなかったため、std::stable_sort に置き換えた。
+		 */
+		void
+		build(size_t* buffer,
+			  const std::array<TYPE, N>* values,
+			  size_t index,
+			  size_t from,
+			  size_t to,
+			  size_t depth)
+			{
+				assert(tree_);
+				assert(buffer);
+				assert(values);
+				assert(from <= to);
+
+				size_t k = (from + to) / 2;
+				if (from < to) {
+#ifndef	__KD_SEARCH_ARRAY_USE_SELECTION__
+					size_t d = depth % N;
+					std::stable_sort(buffer + from, buffer + to + 1,
+									 [values, d] (size_t l, size_t r) { return values[l][d] <= values[r][d]; });
+#else	// !__KD_SEARCH_ARRAY_USE_SELECTION__
+					Select(buffer, values, k, from, to, depth % N, mt_);
+#endif	// !__KD_SEARCH_ARRAY_USE_SELECTION__
+				}
+				tree_[index] = buffer[k];
+
+				if (from < k) build(buffer, values, index * 2 + 1, from, k - 1, depth + 1);
+				if (k < to) build(buffer, values, index * 2 + 2, k + 1, to, depth + 1);
+			}
+
+		/**
+		 * 範囲内の点の走査
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
 		 * @param[in]	from	探索範囲の始点
 		 * @param[in]	to	探索範囲の終点
-		 * @param[out]	points	探索範囲内にある @a values 内の点のインデックス
+		 * @param[in]	function	範囲内の点ごとの処理 (kD木内のインデックスを受け取る)
 		 * @param[in]	index	kD木内での探索対象のインデックス
 		 * @param[in]	depth	kD木内での探索対象の深さ
-		 * @note	通常利用では、引数 @a index, @a depth はデフォルト値で良い。
 		 */
+		template<typename FUNCTION>
 		void
-		find(const std::array<TYPE, N>* values,
+		scan(const std::array<TYPE, N>* values,
 			 const std::array<TYPE, N>& from,
 			 const std::array<TYPE, N>& to,
-			 std::vector<size_t>& points,
-			 size_t index = 0,
-			 size_t depth = 0)
+			 FUNCTION& function,
+			 size_t index,
+			 size_t depth) const
 			{
-				assert(tree_);
-				assert(0 < length_);
-				assert(values);
-				assert(tree_[index] < ~0LU);
+				if (tree_[index] == ~0LU) return;
 
-				size_t x = tree_[index];
+				const std::array<TYPE, N>& p = coordinate(values, index);
 				bool f(true);
 
 				for (size_t i(0); i < N && f; ++i) {
-					f = (from[i] <= values[x][i]) & (values[x][i] <= to[i]);
+					f = (from[i] <= p[i]) & (p[i] <= to[i]);
 				}
 
-				if (f) points.push_back(x);
+				if (f && !dead(index)) function(index);
 
 				size_t k = index * 2 + 1;
 				size_t d = depth % N;
-				if (k < length_ && tree_[k] < ~0LU && from[d] <= values[x][d]) {
-					find(values, from, to, points, k, depth + 1);
+				if (occupied(k) && from[d] <= p[d]) {
+					scan(values, from, to, function, k, depth + 1);
 				}
 
 				++k;
-				if (k < length_ && tree_[k] < ~0LU && values[x][d] <= to[d]) {
-					find(values, from, to, points, k, depth + 1);
+				if (occupied(k) && p[d] <= to[d]) {
+					scan(values, from, to, function, k, depth + 1);
 				}
 			}
+
+		/**
+		 * 部分木内の半径内の点の探索
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	r	半径 (順位付け用の距離)
+		 * @param[in]	metric	距離
+		 * @param[out]	points	半径内にある @a values 内の点のインデックス
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @param[in]	bound	部分木までの距離の下限
+		 * @param[in,out]	offsets	次元ごとの分割面までの下限 (戻る時に元に戻す)
+		 */
+		template<typename METRIC>
+		void
+		around(const std::array<TYPE, N>* values,
+			   const std::array<TYPE, N>& query,
+			   double r,
+			   const METRIC& metric,
+			   std::vector<size_t>& points,
+			   size_t index,
+			   size_t depth,
+			   double bound,
+			   std::array<double, N>& offsets) const
+			{
+				const std::array<TYPE, N>& p = coordinate(values, index);
+				if (!dead(index) && metric.distance(query, p) <= r) points.push_back(tree_[index]);
+
+				size_t d = depth % N;
+				bool l = query[d] < p[d];
+				size_t n = index * 2 + (l ? 1 : 2);
+				size_t f = index * 2 + (l ? 2 : 1);
+				if (occupied(n)) {
+					around(values, query, r, metric, points, n, depth + 1, bound, offsets);
+				}
+
+				double w = metric.plane(query, d, p[d]);
+				double h = metric.update(bound, offsets[d], w);
+				if (occupied(f) && h <= r) {
+					double o = offsets[d];
+					offsets[d] = w;
+					around(values, query, r, metric, points, f, depth + 1, h, offsets);
+					offsets[d] = o;
+				}
+			}
+
+		typedef std::pair<double, std::pair<size_t, size_t> > Bin;	///< (下限, (kD木内のインデックス, @a Step の位置))
+
+		/**
+		 * 未探索の部分木の分割面までの下限 (親の部分木からの差分)
+		 * @note	遠い側の子は親と1次元だけ下限が異なるので、その次元の値だけを持ち、
+					残りは @a parent を辿って求める。
+		 */
+		struct Step
+		{
+			size_t parent;	///< 親の @a Step の位置 (無ければ ~0LU)
+			size_t depth;	///< 部分木の根の深さ (変わった次元は (depth - 1) % N)
+			double offset;	///< 変わった次元の分割面までの下限
+		};
+
+		/**
+		 * 近傍の候補の追加
+		 * @param[in]	k	探索する点の数
+		 * @param[in]	s	点までの順位付け用の距離
+		 * @param[in]	index	点の kD木内のインデックス
+		 * @param[in,out]	best	(順位付け用の距離, データ内のインデックス) の最大ヒープ
+		 * @param[in,out]	closest	最も近い点の (順位付け用の距離, kD木内のインデックス)
+		 */
+		void
+		offer(size_t k,
+			  double s,
+			  size_t index,
+			  std::vector<std::pair<double, size_t> >& best,
+			  std::pair<double, size_t>& closest) const
+			{
+				if (s < closest.first) closest = std::make_pair(s, index);
+
+				if (best.size() < k) {
+					best.push_back(std::make_pair(s, tree_[index]));
+					std::push_heap(best.begin(), best.end());
+				}
+				else if (s < best.front().first) {
+					std::pop_heap(best.begin(), best.end());
+					best.back() = std::make_pair(s, tree_[index]);
+					std::push_heap(best.begin(), best.end());
+				}
+			}
+
+		/**
+		 * 下限の 1 + epsilon 倍
+		 * @param[in]	metric	距離
+		 * @param[in]	epsilon	許容する誤差
+		 * @param[in]	bound	下限 (順位付け用の距離)
+		 * @return	実距離を 1 + @a epsilon 倍した下限 (順位付け用の距離)
+		 */
+		template<typename METRIC>
+		static double
+		Scale(const METRIC& metric,
+			  double epsilon,
+			  double bound)
+			{
+				return epsilon == 0.0 ? bound : metric.rank(metric.unrank(bound) * (1.0 + epsilon));
+			}
+
+		/**
+		 * 部分木の深さ優先の近傍探索
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	k	探索する点の数
+		 * @param[in]	epsilon	許容する誤差
+		 * @param[in]	metric	距離
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @param[in]	bound	部分木までの距離の下限
+		 * @param[in,out]	offsets	次元ごとの分割面までの下限 (戻る時に元に戻す)
+		 * @param[in,out]	best	(順位付け用の距離, データ内のインデックス) の最大ヒープ
+		 * @param[in,out]	closest	最も近い点の (順位付け用の距離, kD木内のインデックス)
+		 * @note	距離を計算する点の数に上限が無い場合に使う。近い側の子を先に辿り、
+					遠い側の子は戻った時点の k 番目の距離で枝刈りするので、作業領域が要らない。
+		 */
+		template<typename METRIC>
+		void
+		descend(const std::array<TYPE, N>* values,
+				const std::array<TYPE, N>& query,
+				size_t k,
+				double epsilon,
+				const METRIC& metric,
+				size_t index,
+				size_t depth,
+				double bound,
+				std::array<double, N>& offsets,
+				std::vector<std::pair<double, size_t> >& best,
+				std::pair<double, size_t>& closest) const
+			{
+				const std::array<TYPE, N>& p = coordinate(values, index);
+				if (!dead(index)) offer(k, metric.distance(query, p), index, best, closest);
+
+				size_t d = depth % N;
+				bool l = query[d] < p[d];
+				size_t n = index * 2 + (l ? 1 : 2);
+				size_t f = index * 2 + (l ? 2 : 1);
+				if (occupied(n)) {
+					descend(values, query, k, epsilon, metric, n, depth + 1, bound, offsets, best, closest);
+				}
+
+				double w = metric.plane(query, d, p[d]);
+				double h = metric.update(bound, offsets[d], w);
+				if (occupied(f) && (best.size() < k || Scale(metric, epsilon, h) < best.front().first)) {
+					double o = offsets[d];
+					offsets[d] = w;
+					descend(values, query, k, epsilon, metric, f, depth + 1, h, offsets, best, closest);
+					offsets[d] = o;
+				}
+			}
+
+		/**
+		 * 部分木の近い順の探索 (best-bin-first)
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	k	探索する点の数
+		 * @param[in]	epsilon	許容する誤差
+		 * @param[in]	checks	距離を計算する点の数の上限 (0なら上限無し)
+		 * @param[in]	metric	距離
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @param[in]	depth	部分木の根の深さ
+		 * @param[in]	bound	部分木までの距離の下限
+		 * @param[in]	offset	次元ごとの分割面までの下限
+		 * @param[in,out]	best	(順位付け用の距離, データ内のインデックス) の最大ヒープ
+		 * @param[out]	bins	作業領域 (未探索の部分木の最小ヒープ)
+		 * @param[out]	steps	作業領域 (未探索の部分木の分割面までの下限の差分)
+		 * @param[in,out]	closest	最も近い点の (順位付け用の距離, kD木内のインデックス)
+		 * @param[in,out]	c	距離を計算した点の数
+		 */
+		template<typename METRIC>
+		void
+		browse(const std::array<TYPE, N>* values,
+			   const std::array<TYPE, N>& query,
+			   size_t k,
+			   double epsilon,
+			   size_t checks,
+			   const METRIC& metric,
+			   size_t index,
+			   size_t depth,
+			   double bound,
+			   const std::array<double, N>& offset,
+			   std::vector<std::pair<double, size_t> >& best,
+			   std::vector<Bin>& bins,
+			   std::vector<Step>& steps,
+			   std::pair<double, size_t>& closest,
+			   size_t& c) const
+			{
+				const size_t start(depth);
+				bins.clear();
+				steps.clear();
+				bins.push_back(Bin(bound, std::make_pair(index, ~0LU)));
+				while (!bins.empty()) {
+					std::pop_heap(bins.begin(), bins.end(), std::greater<Bin>());
+					double b = bins.back().first;
+					size_t i = bins.back().second.first;
+					size_t s = bins.back().second.second;
+					bins.pop_back();
+					if (best.size() == k && best.front().first <= Scale(metric, epsilon, b)) break;
+
+					// 差分を子から親へ辿り、各次元で最も深い差分を使う
+					std::array<double, N> o(offset);
+					std::array<bool, N> e;
+					e.fill(false);
+					depth = s == ~0LU ? start : steps[s].depth;
+					for (size_t j(s); j != ~0LU; j = steps[j].parent) {
+						size_t d = (steps[j].depth - 1) % N;
+						if (!e[d]) o[d] = steps[j].offset;
+						e[d] = true;
+					}
+
+					while (i < length_ && tree_[i] < ~0LU) {
+						if (0 < checks && checks <= c) break;
+
+						const std::array<TYPE, N>& p = coordinate(values, i);
+						if (!dead(i)) {
+							offer(k, metric.distance(query, p), i, best, closest);
+							++c;
+						}
+
+						size_t d = depth % N;
+						bool l = query[d] < p[d];
+						size_t n = i * 2 + (l ? 1 : 2);
+						size_t f = i * 2 + (l ? 2 : 1);
+						double w = metric.plane(query, d, p[d]);
+						double h = metric.update(b, o[d], w);
+						if (occupied(f) && (best.size() < k || Scale(metric, epsilon, h) < best.front().first)) {
+							Step t = {s, depth + 1, w};
+							steps.push_back(t);
+							bins.push_back(Bin(h, std::make_pair(f, steps.size() - 1)));
+							std::push_heap(bins.begin(), bins.end(), std::greater<Bin>());
+						}
+
+						if (!occupied(n)) break;
+						i = n;
+						++depth;
+					}
+
+					if (0 < checks && checks <= c) break;
+				}
+			}
+
+	protected:
+
+		/**
+		 * 部分木の再構築で引き取った座標を移したことの通知
+		 * @param[in]	sources	移動元の kD木内のインデックス
+		 * @param[in]	targets	移動先の kD木内のインデックス
+		 * @param[in]	length	移動した点の数
+		 * @return	成功したら true
+		 * @note	木の並び順に情報を持つ派生クラスが、同じように並べ替えるために使う。
+		 */
+		virtual bool
+		moved(const size_t* sources,
+			  const size_t* targets,
+			  size_t length)
+			{
+				(void)sources;
+				(void)targets;
+				(void)length;
+
+				return true;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDSearchArray()
+			: allocator_(), tree_(0), length_(0), size_(0), points_(0), owned_(allocator_), mapping_(0), mapping_size_(0), unmap_(0),
+			  buffer_(0), buffer_length_(0), keep_(false),
+			  dead_(allocator_), live_(allocator_), count_(allocator_), slot_(allocator_),
+			  categories_(allocator_), masks_(allocator_), threshold_(0.25)
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+			, mt_(0)
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			{
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+				std::random_device rd;
+				mt_ = new std::mt19937(rd());
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			}
+
+		/**
+		 * アロケータを指定するコンストラクタ
+		 * @param[in]	allocator	内部の領域を確保するアロケータ
+		 */
+		explicit KDSearchArray(const ALLOCATOR& allocator)
+			: allocator_(allocator), tree_(0), length_(0), size_(0), points_(0), owned_(allocator_), mapping_(0), mapping_size_(0), unmap_(0),
+			  buffer_(0), buffer_length_(0), keep_(false),
+			  dead_(allocator_), live_(allocator_), count_(allocator_), slot_(allocator_),
+			  categories_(allocator_), masks_(allocator_), threshold_(0.25)
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+			, mt_(0)
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			{
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+				std::random_device rd;
+				mt_ = new std::mt19937(rd());
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDSearchArray(const KDSearchArray<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDSearchArray&
+		operator =(const KDSearchArray<TYPE, N, ALLOCATOR>&) = delete;
+
+		/**
+		 * ムーブ・コンストラクタ
+		 * @param[in,out]	other	移動元 (空のkD木になる)
+		 */
+		KDSearchArray(KDSearchArray<TYPE, N, ALLOCATOR>&& other) noexcept
+			: allocator_(other.allocator_), tree_(0), length_(0), size_(0), points_(0), owned_(allocator_), mapping_(0), mapping_size_(0), unmap_(0),
+			  buffer_(0), buffer_length_(0), keep_(false),
+			  dead_(allocator_), live_(allocator_), count_(allocator_), slot_(allocator_),
+			  categories_(allocator_), masks_(allocator_), threshold_(0.25)
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+			, mt_(0)
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			{
+				swap(other);
+			}
+
+		/**
+		 * ムーブ代入演算子
+		 * @param[in,out]	other	移動元 (元の内容と入れ替わる)
+		 * @return	自身
+		 */
+		KDSearchArray&
+		operator =(KDSearchArray<TYPE, N, ALLOCATOR>&& other) noexcept
+			{
+				swap(other);
+				return *this;
+			}
+
+		/**
+		 * 内容の交換
+		 * @param[in,out]	other	交換相手
+		 */
+		void
+		swap(KDSearchArray<TYPE, N, ALLOCATOR>& other) noexcept
+			{
+				std::swap(allocator_, other.allocator_);
+				std::swap(tree_, other.tree_);
+				std::swap(length_, other.length_);
+				std::swap(size_, other.size_);
+				std::swap(points_, other.points_);
+				owned_.swap(other.owned_);
+				std::swap(mapping_, other.mapping_);
+				std::swap(mapping_size_, other.mapping_size_);
+				std::swap(unmap_, other.unmap_);
+				std::swap(buffer_, other.buffer_);
+				std::swap(buffer_length_, other.buffer_length_);
+				std::swap(keep_, other.keep_);
+				dead_.swap(other.dead_);
+				live_.swap(other.live_);
+				count_.swap(other.count_);
+				slot_.swap(other.slot_);
+				categories_.swap(other.categories_);
+				masks_.swap(other.masks_);
+				std::swap(threshold_, other.threshold_);
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+				std::swap(mt_, other.mt_);
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			}
+
+		/**
+		 * 準備済みのkD木の共有
+		 * @param[in,out]	tree	準備済みのkD木 (空のkD木になる)
+		 * @return	変更できないkD木への共有ポインタ (失敗したら空)
+		 * @note	共有した後は探索 (const なメンバ関数) だけができる。
+		 */
+		static std::shared_ptr<const KDSearchArray<TYPE, N, ALLOCATOR> >
+		Share(KDSearchArray<TYPE, N, ALLOCATOR>&& tree)
+			{
+				try {
+					return std::make_shared<const KDSearchArray<TYPE, N, ALLOCATOR> >(std::move(tree));
+				}
+				catch (...) {
+					return std::shared_ptr<const KDSearchArray<TYPE, N, ALLOCATOR> >();
+				}
+			}
+
+		/**
+		 * デストラクタ
+		 */
+		virtual
+		~KDSearchArray()
+			{
+				clear();
+				dispose();
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+				if (mt_) delete mt_;
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+			}
+
+		/**
+		 * kD木の準備
+		 * @param[in]	values	データ
+		 * @param[in]	length	配列 @a values の要素数
+		 */
+		bool
+		prepare(const std::array<TYPE, N>* values,
+				size_t length)
+			{
+				assert(values);
+				assert(0 < length);
+				assert(length < ~0LU);
+
+				size_t l(1);
+				while (l <= length) l *= 2;	// 右側の部分木は左側より1段深くなり得る
+
+#ifdef	__KD_SEARCH_ARRAY_USE_SELECTION__
+				if (!mt_) {		// ムーブで手放した場合
+					try {
+						std::random_device rd;
+						mt_ = new std::mt19937(rd());
+					}
+					catch (...) {
+						return false;
+					}
+				}
+#endif	// __KD_SEARCH_ARRAY_USE_SELECTION__
+
+				clear();
+
+				if (!acquire(length)) return false;
+				try {
+					tree_ = IndexTraits::allocate(allocator_, l);
+				}
+				catch (...) {
+					recycle();
+					return false;
+				}
+
+				std::fill(tree_, tree_ + l, ~0LU);
+				for (size_t i(0); i < length; ++i) buffer_[i] = i;
+				length_ = l;
+				size_ = length;
+				build(buffer_, values, 0, 0, length - 1, 0);
+				recycle();
+
+				return true;
+			}
+
+		/**
+		 * 座標を引き取るkD木の準備
+		 * @param[in]	values	データ (準備後は不要)
+		 * @param[in]	length	配列 @a values の要素数
+		 * @return	成功したら true
+		 * @note	座標を配列 @a tree_ の並び順に複製して持つので、探索は引数 @a values 無しで行え、
+					座標を木の並び順に連続して読む。探索結果は元の @a values 内のインデックス。
+		 * @note	複製は @a Extent (@a length) 個分で、容量 @a capacity まで空きを持たない。
+		 */
+		bool
+		prepare_owned(const std::array<TYPE, N>* values,
+					  size_t length)
+			{
+				if (!prepare(values, length)) return false;
+
+				size_t e = Extent(size_);
+				assert(tree_[e - 1] < ~0LU);
+				try {
+					owned_.resize(e);	// 容量 @a length_ ではなく使われる範囲だけ持つ
+				}
+				catch (...) {
+					clear();
+					return false;
+				}
+
+				for (size_t i(0); i < e; ++i) {
+					if (tree_[i] < ~0LU) owned_[i] = values[tree_[i]];
+				}
+				points_ = owned_.data();
+
+				return true;
+			}
+
+		/**
+		 * kD木の探索
+		 * @param[in]	values	データ (0の場合はマップした座標を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある @a values 内の点のインデックス
+		 * @param[in]	index	kD木内での探索対象のインデックス
+		 * @param[in]	depth	kD木内での探索対象の深さ
+		 * @note	通常利用では、引数 @a index, @a depth はデフォルト値で良い。
+		 */
+		void
+		find(const std::array<TYPE, N>* values,
+			 const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points,
+			 size_t index = 0,
+			 size_t depth = 0) const
+			{
+				assert(tree_);
+				assert(0 < length_);
+				assert(values || points_);
+
+				if (tree_[index] == ~0LU) return;	// 全ての点が削除された
+
+				const std::array<TYPE, N>& p = coordinate(values, index);
+				bool f(true);
+
+				for (size_t i(0); i < N && f; ++i) {
+					f = (from[i] <= p[i]) & (p[i] <= to[i]);
+				}
+
+				if (f && !dead(index)) points.push_back(tree_[index]);
+
+				size_t k = index * 2 + 1;
+				size_t d = depth % N;
+				if (occupied(k) && from[d] <= p[d]) {
+					find(values, from, to, points, k, depth + 1);
+				}
+
+				++k;
+				if (occupied(k) && p[d] <= to[d]) {
+					find(values, from, to, points, k, depth + 1);
+				}
+			}
+
+		/**
+		 * 分類の設定
+		 * @param[in]	categories	各点の分類のビットマスク (要素数は @a size)
+		 * @return	成功したら true
+		 * @note	部分木ごとに分類のビットマスクの論理和を求めておき、
+					分類を指定した @a find で該当する分類の無い部分木を辿らないようにする。
+					削除では更新しない (論理和が広いままでも結果は正しい) が、部分木を作り直す際に更新する。
+		 */
+		bool
+		categorize(const uint64_t* categories)
+			{
+				assert(tree_);
+				assert(categories);
+
+				try {
+					categories_.assign(categories, categories + size_);
+					masks_.assign(length_, 0);
+				}
+				catch (...) {
+					BitVector(allocator_).swap(categories_);
+					BitVector(allocator_).swap(masks_);
+					return false;
+				}
+				mark(0);
+
+				return true;
+			}
+
+		/**
+		 * 分類を指定したkD木の探索
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[in]	mask	探索する分類のビットマスク (分類と共通のビットがある点を探す)
+		 * @param[out]	points	探索範囲内にある @a values 内の点のインデックス
+		 * @param[in]	index	kD木内での探索対象のインデックス
+		 * @param[in]	depth	kD木内での探索対象の深さ
+		 * @note	@a categorize で分類を設定した後に使うこと。
+		 */
+		void
+		find(const std::array<TYPE, N>* values,
+			 const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 uint64_t mask,
+			 std::vector<size_t>& points,
+			 size_t index = 0,
+			 size_t depth = 0) const
+			{
+				assert(tree_);
+				assert(values || points_);
+				assert(!masks_.empty());
+
+				if (tree_[index] == ~0LU || !(masks_[index] & mask)) return;
+
+				const std::array<TYPE, N>& p = coordinate(values, index);
+				bool f = (categories_[tree_[index]] & mask) != 0;
+
+				for (size_t i(0); i < N && f; ++i) {
+					f = (from[i] <= p[i]) & (p[i] <= to[i]);
+				}
+
+				if (f && !dead(index)) points.push_back(tree_[index]);
+
+				size_t k = index * 2 + 1;
+				size_t d = depth % N;
+				if (occupied(k) && from[d] <= p[d] && (this->mask(k) & mask)) {
+					find(values, from, to, mask, points, k, depth + 1);
+				}
+
+				++k;
+				if (occupied(k) && p[d] <= to[d] && (this->mask(k) & mask)) {
+					find(values, from, to, mask, points, k, depth + 1);
+				}
+			}
+
+		/**
+		 * 分類を指定した木の並び順の座標を使ったkD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[in]	mask	探索する分類のビットマスク
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 uint64_t mask,
+			 std::vector<size_t>& points) const
+			{
+				assert(points_);
+
+				find(0, from, to, mask, points);
+			}
+
+		/**
+		 * 周期境界を回り込む範囲のkD木の探索
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある @a values 内の点のインデックス
+		 * @param[in]	index	kD木内での探索対象のインデックス
+		 * @param[in]	depth	kD木内での探索対象の深さ
+		 * @note	次元 i で @a from[i] > @a to[i] なら、その次元の範囲は周期の境界を回り込む
+					([@a from[i], 上限] と [下限, @a to[i]] の和)。ずらした範囲で何度も探索せずに1回で辿る。
+					半径・近傍の探索の周期境界は kd_metric.hpp の KDPeriodic を使う。
+		 */
+		void
+		find_periodic(const std::array<TYPE, N>* values,
+					  const std::array<TYPE, N>& from,
+					  const std::array<TYPE, N>& to,
+					  std::vector<size_t>& points,
+					  size_t index = 0,
+					  size_t depth = 0) const
+			{
+				assert(tree_);
+				assert(values || points_);
+
+				if (tree_[index] == ~0LU) return;
+
+				const std::array<TYPE, N>& p = coordinate(values, index);
+				bool f(true);
+
+				for (size_t i(0); i < N && f; ++i) {
+					f = from[i] <= to[i]
+						? (from[i] <= p[i]) & (p[i] <= to[i])
+						: (from[i] <= p[i]) | (p[i] <= to[i]);
+				}
+
+				if (f && !dead(index)) points.push_back(tree_[index]);
+
+				size_t k = index * 2 + 1;
+				size_t d = depth % N;
+				bool w = to[d] < from[d];
+				if (occupied(k) && (w || from[d] <= p[d])) {
+					find_periodic(values, from, to, points, k, depth + 1);
+				}
+
+				++k;
+				if (occupied(k) && (w || p[d] <= to[d])) {
+					find_periodic(values, from, to, points, k, depth + 1);
+				}
+			}
+
+		/**
+		 * 範囲内の点ごとの処理
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[in]	function	範囲内の点ごとの処理 (kD木内のインデックスを受け取る)
+		 * @note	kD木内のインデックスは @a at, @a coordinate に渡せる。
+		 */
+		template<typename FUNCTION>
+		void
+		visit(const std::array<TYPE, N>* values,
+			  const std::array<TYPE, N>& from,
+			  const std::array<TYPE, N>& to,
+			  FUNCTION function) const
+			{
+				assert(tree_);
+				assert(values || points_);
+
+				scan(values, from, to, function, 0, 0);
+			}
+
+		/**
+		 * 木の並び順の座標を使ったkD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @note	@a prepare_owned で準備した場合か、
+					KDMappedImage::Open で座標付きのイメージを開いた場合のみ利用可能。
+		 */
+		void
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points) const
+			{
+				assert(points_);
+
+				find(0, from, to, points);
+			}
+
+		/**
+		 * 近傍探索 (近似も可)
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	k	探索する点の数
+		 * @param[out]	neighbors	近い順に並べた (順位付け用の距離, @a values 内の点のインデックス) の組
+		 * @param[in]	epsilon	許容する誤差 (i番目の点の距離は真のi番目の距離の 1 + @a epsilon 倍以内)
+		 * @param[in]	checks	距離を計算する点の数の上限 (0なら上限無し)
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照、既定はユークリッド距離で順位付け用の距離は2乗)
+		 * @note	@a checks が0なら深さ優先に辿り、@a checks を指定すると近い順に部分木を辿る (best-bin-first)。
+					@a epsilon が0で @a checks が0なら厳密解。
+					部分木までの距離の下限は、次元ごとの分割面までの距離から増分的に求める。
+		 */
+		template<typename METRIC = KDEuclidean<TYPE, N> >
+		void
+		nearest(const std::array<TYPE, N>* values,
+				const std::array<TYPE, N>& query,
+				size_t k,
+				std::vector<std::pair<double, size_t> >& neighbors,
+				double epsilon = 0.0,
+				size_t checks = 0,
+				const METRIC& metric = METRIC()) const
+			{
+				assert(tree_);
+				assert(values || points_);
+				assert(0.0 <= epsilon);
+
+				neighbors.clear();
+				if (k == 0 || tree_[0] == ~0LU) return;
+
+				std::vector<std::pair<double, size_t> > best;
+				std::pair<double, size_t> closest(std::numeric_limits<double>::infinity(), ~0LU);
+				std::array<double, N> o;
+
+				o.fill(0.0);
+				if (checks == 0) {
+					descend(values, query, k, epsilon, metric, 0, 0, 0.0, o, best, closest);
+				}
+				else {
+					std::vector<Bin> bins;
+					std::vector<Step> steps;
+					size_t c(0);
+					browse(values, query, k, epsilon, checks, metric, 0, 0, 0.0, o, best, bins, steps, closest, c);
+				}
+
+				std::sort_heap(best.begin(), best.end());
+				neighbors.swap(best);
+			}
+
+		/**
+		 * 前回の結果を起点にした近傍探索 (厳密解)
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	k	探索する点の数
+		 * @param[out]	neighbors	近い順に並べた (順位付け用の距離, @a values 内の点のインデックス) の組
+		 * @param[in,out]	hint	探索を始める kD木内のインデックス (最も近い点の kD木内のインデックスを返す)
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照)
+		 * @note	@a hint の部分木を先に探索し、得られた k 番目の距離の球が部分木の包含矩形に
+					収まるまで祖先へ上って、祖先の点と兄弟の部分木だけを探索する。
+					連続する探索の中心が近い場合 (ICP・追跡等) に、辿る節の数を大きく減らせる。
+					@a hint には前回返された値をそのまま渡す (範囲外・空の位置なら根から探索する)。
+					部分木の再構築で点が動いても結果は正しい (探索が速くならないだけ)。
+		 */
+		template<typename METRIC = KDEuclidean<TYPE, N> >
+		void
+		nearest_from(const std::array<TYPE, N>* values,
+					 const std::array<TYPE, N>& query,
+					 size_t k,
+					 std::vector<std::pair<double, size_t> >& neighbors,
+					 size_t& hint,
+					 const METRIC& metric = METRIC()) const
+			{
+				assert(tree_);
+				assert(values || points_);
+
+				neighbors.clear();
+				if (k == 0 || tree_[0] == ~0LU) return;
+				if (length_ <= hint || tree_[hint] == ~0LU) hint = 0;
+
+				// 根から @a hint までの経路 (深さは64未満)
+				std::array<size_t, 64> path;
+				size_t m(0);
+				for (size_t i(hint); 0 < i; i = (i - 1) / 2) ++m;
+				for (size_t i(hint), j(m);; i = (i - 1) / 2, --j) {
+					path[j] = i;
+					if (i == 0) break;
+				}
+
+				// 経路上の部分木までの下限 (次元ごとの分割面までの下限も) と、
+				// 部分木の包含矩形に収まる球の大きさ (順位付け用の距離) の上限
+				std::array<std::pair<double, std::array<double, N> >, 64> bounds;
+				std::array<double, 64> limits;
+				bounds[0].first = 0.0;
+				bounds[0].second.fill(0.0);
+				limits[0] = std::numeric_limits<double>::infinity();
+				for (size_t j(0); j < m; ++j) {
+					const std::array<TYPE, N>& p = coordinate(values, path[j]);
+					size_t d = j % N;
+					bool l = path[j+1] == path[j] * 2 + 1;
+					double w = metric.plane(query, d, p[d]);
+					bounds[j+1] = bounds[j];
+					if ((query[d] < p[d]) != l) {
+						bounds[j+1].first = metric.update(bounds[j].first, bounds[j].second[d], w);
+						bounds[j+1].second[d] = w;
+					}
+					limits[j+1] = (l ? query[d] <= p[d] : p[d] <= query[d]) ? std::min(limits[j], w) : -1.0;
+				}
+
+				std::vector<std::pair<double, size_t> > best;
+				std::pair<double, size_t> closest(std::numeric_limits<double>::infinity(), ~0LU);
+				std::array<double, N> o(bounds[m].second);
+
+				descend(values, query, k, 0.0, metric, hint, m, bounds[m].first, o, best, closest);
+
+				for (size_t j(m); 0 < j; --j) {
+					// k 番目の距離の球が path[j] の部分木の包含矩形に収まれば、外側の点は探索しなくて良い
+					if (best.size() == k && best.front().first <= limits[j]) break;
+
+					size_t a = path[j-1];
+					const std::array<TYPE, N>& p = coordinate(values, a);
+					if (!dead(a)) offer(k, metric.distance(query, p), a, best, closest);
+
+					size_t s = path[j] == a * 2 + 1 ? a * 2 + 2 : a * 2 + 1;	// 兄弟
+					if (!occupied(s)) continue;
+
+					size_t d = (j - 1) % N;
+					double b = bounds[j-1].first;
+					o = bounds[j-1].second;
+					if ((query[d] < p[d]) != (s == a * 2 + 1)) {
+						double w = metric.plane(query, d, p[d]);
+						b = metric.update(b, o[d], w);
+						o[d] = w;
+					}
+					if (best.size() < k || b < best.front().first) {
+						descend(values, query, k, 0.0, metric, s, j, b, o, best, closest);
+					}
+				}
+
+				hint = closest.second;
+				std::sort_heap(best.begin(), best.end());
+				neighbors.swap(best);
+			}
+
+		/**
+		 * 半径内の点の探索
+		 * @param[in]	values	データ (0の場合は木の並び順の座標を使う)
+		 * @param[in]	query	探索の中心
+		 * @param[in]	radius	半径 (実距離)
+		 * @param[out]	points	半径内にある @a values 内の点のインデックス
+		 * @param[in]	metric	距離 (kd_metric.hpp を参照)
+		 */
+		template<typename METRIC = KDEuclidean<TYPE, N> >
+		void
+		within(const std::array<TYPE, N>* values,
+			   const std::array<TYPE, N>& query,
+			   double radius,
+			   std::vector<size_t>& points,
+			   const METRIC& metric = METRIC()) const
+			{
+				assert(tree_);
+				assert(values || points_);
+
+				if (tree_[0] == ~0LU) return;
+
+				std::array<double, N> o;
+				o.fill(0.0);
+				around(values, query, metric.rank(radius), metric, points, 0, 0, 0.0, o);
+			}
+
+		/**
+		 * 点の削除
+		 * @param[in]	values	データ (座標を引き取った場合は0で良い)
+		 * @param[in]	index	削除する点の @a values 内のインデックス
+		 * @return	削除したら true (削除済み・範囲外・マップしたイメージの場合は false)
+		 * @note	削除済みの印を付け、削除済みの割合が閾値を超えた最も大きい祖先の部分木だけを作り直す。
+		 */
+		bool
+		erase(const std::array<TYPE, N>* values,
+			  size_t index)
+			{
+				assert(tree_);
+				assert(values || !owned_.empty());
+
+				if (mapping_ || size_ <= index) return false;
+
+				if (live_.empty()) {
+					try {
+						dead_.assign((size_ + 63) / 64, 0);
+						live_.resize(length_);
+						count_.resize(length_);
+						slot_.assign(size_, ~0LU);
+					}
+					catch (...) {
+						forget();
+						return false;
+					}
+					tally(0);
+				}
+
+				if ((dead_[index / 64] >> (index % 64)) & 1) return false;
+				dead_[index / 64] |= (uint64_t)1 << (index % 64);
+
+				size_t k = slot_[index];
+				size_t r(~0LU);
+				for (size_t i(k);; i = (i - 1) / 2) {
+					--live_[i];
+					if (sparse(i)) r = i;
+					if (i == 0) break;
+				}
+
+				return r == ~0LU || rebuild(values, r);
+			}
+
+		/**
+		 * 座標を引き取ったkD木からの点の削除
+		 * @param[in]	index	削除する点のインデックス
+		 * @return	削除したら true (削除済み・範囲外の場合は false)
+		 */
+		bool
+		erase(size_t index)
+			{
+				assert(!owned_.empty());
+
+				return erase(0, index);
+			}
+
+		/**
+		 * 削除済みの点の判定
+		 * @param[in]	index	点の @a values 内のインデックス
+		 * @return	削除済みなら true
+		 */
+		bool
+		erased(size_t index) const
+			{
+				assert(index < size_);
+
+				return !dead_.empty() && (dead_[index / 64] >> (index % 64)) & 1;
+			}
+
+		/**
+		 * 削除されていない点が残っている部分木か否かの判定
+		 * @param[in]	index	部分木の根の kD木内のインデックス
+		 * @return	部分木があり、削除されていない点が残っていれば true
+		 * @note	探索で部分木を辿るか否かの判定に使う (全ての点が削除された部分木は辿らない)。
+		 */
+		bool
+		occupied(size_t index) const
+			{
+				return index < length_ && tree_[index] < ~0LU && (live_.empty() || live_[index]);
+			}
+
+		/**
+		 * 削除済みの割合が閾値を超えた全部分木の再構築
+		 * @param[in]	values	データ (座標を引き取った場合は0で良い)
+		 * @return	成功したら true
+		 */
+		bool
+		compact(const std::array<TYPE, N>* values)
+			{
+				assert(values || !owned_.empty());
+
+				if (live_.empty()) return true;
+
+				return compact(values, 0);
+			}
+
+		/**
+		 * 点の移動後のkD木の修正
+		 * @param[in]	values	移動後のデータ (点の数と並びは @a prepare の時と同じ)
+		 * @param[out]	rebuilt	作り直した点の数 (0以外の場合)
+		 * @return	成功したら true
+		 * @note	配列 @a tree_ の並びを保ったまま分割の条件を下から検証し、
+					点が分割面を越えた部分木だけを作り直す。
+					座標を引き取った場合は、引き取った座標も @a values に合わせて更新する。
+		 */
+		bool
+		refit(const std::array<TYPE, N>* values,
+			  size_t* rebuilt = 0)
+			{
+				assert(tree_);
+				assert(values);
+
+				if (mapping_) return false;
+
+				IndexVector roots(allocator_);
+				if (tree_[0] < ~0LU) {
+					std::array<TYPE, N> l, u;
+					try {
+						validate(values, 0, 0, l, u, roots);
+					}
+					catch (...) {
+						return false;
+					}
+				}
+
+				if (!owned_.empty()) {
+					for (size_t i(0); i < owned_.size(); ++i) {
+						if (tree_[i] < ~0LU) owned_[i] = values[tree_[i]];
+					}
+				}
+
+				bool f(true);
+				size_t r(0);
+				for (size_t i : roots) {
+					size_t c = reshape(values, i);
+					f = f && 0 < c;
+					r += c;
+				}
+				if (rebuilt) *rebuilt = r;
+
+				return f;
+			}
+
+		/**
+		 * 部分木を作り直す閾値の設定
+		 * @param[in]	threshold	削除済みの点の割合 (0以上1未満)
+		 */
+		void
+		set_threshold(double threshold)
+			{
+				assert(0.0 <= threshold && threshold < 1.0);
+
+				threshold_ = threshold;
+			}
+
+		/**
+		 * 構築用の作業領域の予約
+		 * @param[in]	length	確保しておく要素数 (構築する点の数)
+		 * @return	成功したら true
+		 * @note	作業領域は通常は構築の度に確保し、終わったら解放する。
+					予約すると @a release を呼ぶまで残し、以後の構築で再利用する
+					(同じ規模の木を繰り返し作り直す場合に確保を省ける)。
+		 */
+		bool
+		reserve(size_t length)
+			{
+				keep_ = true;
+
+				return acquire(length);
+			}
+
+		/**
+		 * 構築用の作業領域の解放
+		 * @note	@a reserve による予約も取り消す。
+		 */
+		void
+		release()
+			{
+				keep_ = false;
+				dispose();
+			}
+
+		/**
+		 * 点の数の取得
+		 * @return	点の数
+		 */
+		size_t
+		size() const
+			{
+				return size_;
+			}
+
+		/**
+		 * 配列 @a tree_ の容量の取得
+		 * @return	容量 (kD木内のインデックスの上限)
+		 */
+		size_t
+		capacity() const
+			{
+				return length_;
+			}
+
+		/**
+		 * 点の数から使われるインデックスの上限の取得
+		 * @param[in]	length	点の数
+		 * @return	kD木内の最大のインデックス + 1 (点が無ければ0)
+		 * @note	右側の部分木は左側以上の点を持つので、最大のインデックスは右端をたどった先にある。
+					削除による作り直しは元の部分木の領域に収まるので、準備後にこの値を超えることは無い。
+		 */
+		static size_t
+		Extent(size_t length)
+			{
+				if (length == 0) return 0;
+
+				size_t i(0);
+				for (size_t m(length); 1 < m; m /= 2) i = i * 2 + 2;	// 右側の部分木は m / 2 点
+				return i + 1;
+			}
+
+		/**
+		 * kD木内の点のインデックスの取得
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	データ内のインデックス (点が無い場合は ~0LU)
+		 * @note	インデックス @a index の子は @a index * 2 + 1 と @a index * 2 + 2。
+		 */
+		size_t
+		at(size_t index) const
+			{
+				assert(index < length_);
+
+				return tree_[index];
+			}
+
+		/**
+		 * 座標の取得
+		 * @param[in]	values	データ (0の場合は @a points_ を使う)
+		 * @param[in]	index	kD木内のインデックス
+		 * @return	座標
+		 */
+		const std::array<TYPE, N>&
+		coordinate(const std::array<TYPE, N>* values,
+				   size_t index) const
+			{
+				assert(values || points_);
+				assert(index < length_);
+				assert(tree_[index] < ~0LU);
+
+				return values ? values[tree_[index]] : points_[index];
+			}
 	};
 };
 
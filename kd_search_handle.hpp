@@ -0,0 +1,342 @@
+/* -*- coding: utf-8; tab-width: 4 -*- */
+/**
+ * @file	kd_search_handle.hpp
+ * @brief	探索を止めずに作り直せる配列版kD木のハンドル
+ * @author	Yasutaka SHINDOH / 新堂 安孝
+ */
+
+#ifndef	__KD_SEARCH_HANDLE_HPP__
+#define	__KD_SEARCH_HANDLE_HPP__	"kd_search_handle.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <memory>
+#include "kd_search_array.hpp"
+
+namespace ys
+{
+	/**
+	 * 探索を止めずに作り直せる配列版kD木のハンドル
+	 * @note	新しい木は別に構築してから原子的に差し替える (RCU)。
+				探索中のスレッドはエポックを登録し、古い木はそのエポックを
+				登録したスレッドが全て抜けてから解放する。
+				同時に探索できるのは @a SLOTS スレッドまで。それを超えたスレッドは
+				更新側の排他制御を確保して探索する (その間は差し替えが待たされる)。
+	 */
+	template<typename TYPE, size_t N>
+	class KDSearchHandle
+	{
+	private:
+
+		/**
+		 * 版 (kD木とデータの組)
+		 */
+		struct Snapshot
+		{
+			KDSearchArray<TYPE, N> tree;				///< kD木
+			std::vector<std::array<TYPE, N> > values;	///< データ
+
+			/**
+			 * コンストラクタ
+			 */
+			Snapshot()
+				: tree(), values()
+				{
+					;
+				}
+		};
+
+		static const size_t SLOTS = 128;	///< エポックを登録して同時に探索できるスレッド数の上限
+
+		std::atomic<Snapshot*> current_;	///< 公開中の版
+		std::atomic<uint64_t> epoch_;		///< 現在のエポック
+		std::atomic<uint64_t> readers_[SLOTS];	///< 探索中のスレッドのエポック (空きは0)
+		std::vector<std::pair<uint64_t, Snapshot*> > retired_;	///< 解放待ちの版と差し替えたエポック
+		std::mutex mutex_;					///< 更新側の排他制御
+		std::thread worker_;				///< 構築用のスレッド
+
+		/**
+		 * 探索中の登録 (スコープを抜けると解除する)
+		 * @note	探索中に例外が出ても登録が残らないようにする。
+		 */
+		class Reader
+		{
+		private:
+
+			KDSearchHandle<TYPE, N>& handle_;	///< ハンドル
+			size_t slot_;	///< 登録したスロット (空きが無く @a mutex_ を確保した場合は SLOTS)
+
+		public:
+
+			/**
+			 * コンストラクタ (探索の開始)
+			 * @param[in,out]	handle	ハンドル
+			 */
+			explicit Reader(KDSearchHandle<TYPE, N>& handle)
+				: handle_(handle), slot_(handle.enter())
+				{
+					if (slot_ == SLOTS) handle_.mutex_.lock();
+				}
+
+			/**
+			 * コピー・コンストラクタ (使用禁止)
+			 */
+			Reader(const Reader&) = delete;
+
+			/**
+			 * 代入演算子 (使用禁止)
+			 */
+			Reader&
+			operator =(const Reader&) = delete;
+
+			/**
+			 * デストラクタ (探索の終了)
+			 */
+			~Reader()
+				{
+					if (slot_ == SLOTS) handle_.mutex_.unlock();
+					else handle_.leave(slot_);
+				}
+		};
+
+		/**
+		 * 探索の開始 (エポックの登録)
+		 * @return	登録したスロット (空きが無ければ SLOTS)
+		 */
+		size_t
+		enter()
+			{
+				size_t s = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS;
+
+				for (size_t i(0); i < SLOTS; ++i) {
+					uint64_t z(0);
+					if (readers_[s].compare_exchange_strong(z, epoch_.load())) return s;
+					s = (s + 1) % SLOTS;
+				}
+
+				return SLOTS;
+			}
+
+		/**
+		 * 探索の終了 (エポックの登録の解除)
+		 * @param[in]	slot	@a enter で登録したスロット
+		 */
+		void
+		leave(size_t slot)
+			{
+				readers_[slot].store(0);
+			}
+
+		/**
+		 * 解放できる版の解放
+		 * @note	@a mutex_ を確保した状態で呼ぶこと。
+		 */
+		void
+		reclaim()
+			{
+				uint64_t m(~(uint64_t)0);
+				for (size_t i(0); i < SLOTS; ++i) {
+					uint64_t e = readers_[i].load();
+					if (e && e < m) m = e;
+				}
+
+				size_t j(0);
+				for (size_t i(0); i < retired_.size(); ++i) {
+					if (retired_[i].first <= m) delete retired_[i].second;
+					else retired_[j++] = retired_[i];
+				}
+				retired_.resize(j);
+			}
+
+		/**
+		 * 新しい版の公開
+		 * @param[in]	snapshot	構築済みの版
+		 */
+		void
+		publish(Snapshot* snapshot)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				Snapshot* old = current_.exchange(snapshot);
+				uint64_t e = epoch_.fetch_add(1) + 1;
+				if (old) retired_.push_back(std::make_pair(e, old));
+				reclaim();
+			}
+
+		/**
+		 * 版の構築と公開
+		 * @param[in]	values	データ
+		 * @return	成功したら true
+		 */
+		bool
+		build(std::vector<std::array<TYPE, N> >& values)
+			{
+				Snapshot* s(0);
+				try {
+					s = new Snapshot();
+				}
+				catch (...) {
+					return false;
+				}
+
+				s->values.swap(values);
+				if (s->values.empty() || !s->tree.prepare(s->values.data(), s->values.size())) {
+					delete s;
+					return false;
+				}
+
+				publish(s);
+
+				return true;
+			}
+
+	public:
+
+		/**
+		 * コンストラクタ
+		 */
+		KDSearchHandle()
+			: current_(0), epoch_(1), readers_(), retired_(), mutex_(), worker_()
+			{
+				for (size_t i(0); i < SLOTS; ++i) readers_[i].store(0);
+			}
+
+		/**
+		 * コピー・コンストラクタ (使用禁止)
+		 */
+		KDSearchHandle(const KDSearchHandle<TYPE, N>&) = delete;
+
+		/**
+		 * 代入演算子 (使用禁止)
+		 */
+		KDSearchHandle&
+		operator =(const KDSearchHandle<TYPE, N>&) = delete;
+
+		/**
+		 * デストラクタ
+		 * @note	探索中のスレッドが無い状態で破棄すること。
+		 */
+		virtual
+		~KDSearchHandle()
+			{
+				wait();
+
+				for (auto& r : retired_) delete r.second;
+				delete current_.load();
+			}
+
+		/**
+		 * kD木の作り直し (完了まで待つ)
+		 * @param[in]	values	データ (中身は引き取る)
+		 * @return	成功したら true
+		 */
+		bool
+		rebuild(std::vector<std::array<TYPE, N> >&& values)
+			{
+				return build(values);
+			}
+
+		/**
+		 * kD木の作り直し (別スレッドで構築し、完了したら公開する)
+		 * @param[in]	values	データ (中身は引き取る)
+		 * @return	構築を開始できたら true
+		 * @note	前回の構築が終わっていなければ、その完了を待ってから開始する。
+		 * @note	開始できなかった時は values の中身を変えない。
+		 */
+		bool
+		rebuild_async(std::vector<std::array<TYPE, N> >&& values)
+			{
+				wait();
+
+				std::unique_ptr<std::vector<std::array<TYPE, N> > > v;
+				try {
+					v.reset(new std::vector<std::array<TYPE, N> >());
+				}
+				catch (...) {
+					return false;
+				}
+
+				v->swap(values);
+				try {
+					std::vector<std::array<TYPE, N> >* p = v.get();
+					worker_ = std::thread([this, p] () {
+							std::unique_ptr<std::vector<std::array<TYPE, N> > > holder(p);
+							build(*holder);
+						});
+				}
+				catch (...) {
+					v->swap(values);	// スレッドを作れなければ呼び出し元にデータを返す
+					return false;
+				}
+				v.release();	// 以後はスレッドが解放する
+
+				return true;
+			}
+
+		/**
+		 * 構築中のkD木の完了待ち
+		 */
+		void
+		wait()
+			{
+				if (worker_.joinable()) worker_.join();
+			}
+
+		/**
+		 * 公開中の版に対する処理
+		 * @param[in]	function	処理 (kD木とデータを受け取る)
+		 * @return	公開中の版があれば true
+		 * @note	処理の間は、その版が解放されないことが保証される。
+					処理が例外を出した場合も登録を解除してから、例外をそのまま伝える。
+					@a SLOTS を超えるスレッドが同時に探索すると、超えた分は更新側の排他制御の下で
+					処理するので、処理の中から @a rebuild や @a collect を呼ばないこと。
+		 */
+		template<typename FUNCTION>
+		bool
+		read(FUNCTION function)
+			{
+				Reader r(*this);
+				Snapshot* p = current_.load();
+				if (p) function(static_cast<const KDSearchArray<TYPE, N>&>(p->tree), p->values.data());
+
+				return p != 0;
+			}
+
+		/**
+		 * kD木の探索
+		 * @param[in]	from	探索範囲の始点
+		 * @param[in]	to	探索範囲の終点
+		 * @param[out]	points	探索範囲内にある点のインデックス
+		 * @return	公開中の版があれば true
+		 */
+		bool
+		find(const std::array<TYPE, N>& from,
+			 const std::array<TYPE, N>& to,
+			 std::vector<size_t>& points)
+			{
+				return read([&] (const KDSearchArray<TYPE, N>& tree, const std::array<TYPE, N>* values) {
+						tree.find(values, from, to, points);
+					});
+			}
+
+		/**
+		 * 解放待ちの版の解放
+		 * @note	差し替え時にも呼ばれるが、探索が長引いた場合の後始末に使う。
+		 */
+		void
+		collect()
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				reclaim();
+			}
+	};
+};
+
+#endif	// __KD_SEARCH_HANDLE_HPP__
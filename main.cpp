@@ -6,15 +6,1338 @@
  */
 
 #include <cstdio>
+#include <cmath>
 #include <array>
 #include <vector>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include "kd_search_array.hpp"
+#include "kd_mapped_image.hpp"
+#include "kd_point_loader.hpp"
+#include "kd_external_builder.hpp"
+#include "kd_paged_array.hpp"
+#include "kd_dynamic_array.hpp"
+#include "kd_search_handle.hpp"
+#include "kd_numa.hpp"
+#include "kd_arena.hpp"
+#include "kd_payload_array.hpp"
+#include "kd_aggregate_array.hpp"
+#include "kd_forest.hpp"
+#include "kd_nearest_iterator.hpp"
+#include "kd_dual_tree.hpp"
+#include "kd_range_cursor.hpp"
 
 #define	M	6
 #define	N	2
 
+typedef std::array<float, 3>	Point;
+
+/**
+ * 乱数の点の生成
+ * @param[in]	length	点の数
+ * @param[in]	seed	乱数の種
+ * @return	点 (座標は0以上100未満の整数なので、同じ座標の点も含む)
+ */
+static std::vector<Point>
+Random(size_t length,
+	   unsigned int seed)
+{
+	std::mt19937 mt(seed);
+	std::vector<Point> points(length);
+	for (auto& p : points) {
+		for (auto& x : p) x = (float)(mt() % 100);
+	}
+	return points;
+}
+
+/**
+ * 全探索による範囲探索
+ * @param[in]	points	点
+ * @param[in]	from	探索範囲の始点
+ * @param[in]	to	探索範囲の終点
+ * @param[in]	dead	削除済みの点 (空なら削除無し)
+ * @return	探索範囲内にある点のインデックス (昇順)
+ */
+static std::vector<size_t>
+Brute(const std::vector<Point>& points,
+	  const Point& from,
+	  const Point& to,
+	  const std::vector<bool>& dead = std::vector<bool>())
+{
+	std::vector<size_t> output;
+	for (size_t i(0); i < points.size(); ++i) {
+		if (!dead.empty() && dead[i]) continue;
+		bool f(true);
+		for (size_t j(0); j < 3 && f; ++j) f = from[j] <= points[i][j] && points[i][j] <= to[j];
+		if (f) output.push_back(i);
+	}
+	return output;
+}
+
+/**
+ * 結果の並べ替え
+ * @param[in]	points	点のインデックス
+ * @return	昇順に並べ替えた @a points
+ */
+static std::vector<size_t>
+Sorted(std::vector<size_t> points)
+{
+	std::sort(points.begin(), points.end());
+	return points;
+}
+
+/**
+ * ファイル・イメージの保存とマップの確認
+ * @return	正しければ true
+ */
+static bool
+CheckMappedImage()
+{
+	const char* path = "check_image.bin";
+	std::vector<Point> points = Random(2000, 26);
+	ys::KDSearchArray<float, 3> tree, mapped;
+	if (!tree.prepare(points.data(), points.size())) return false;
+	if (!ys::KDMappedImage<float, 3>::Save(tree, path, points.data())) return false;
+
+	bool f = ys::KDMappedImage<float, 3>::Open(mapped, path);
+	for (size_t i(0); f && i < 20; ++i) {
+		Point from = {{(float)(i * 3), (float)(i * 2), 10.0f}};
+		Point to = {{from[0] + 40.0f, from[1] + 50.0f, 60.0f}};
+		std::vector<size_t> output;
+		mapped.find(from, to, output);
+		f = Sorted(output) == Brute(points, from, to);
+	}
+	mapped = ys::KDSearchArray<float, 3>();
+
+	// 範囲外のインデックスを含む壊れたイメージは開かない
+	std::FILE* file = std::fopen(path, "r+b");
+	if (file) {
+		size_t bad = points.size();
+		std::fseek(file, (long)ys::KDSearchArrayImage::Align(sizeof(ys::KDSearchArrayImage)), SEEK_SET);
+		std::fwrite(&bad, sizeof(bad), 1, file);
+		std::fclose(file);
+		f = f && !ys::KDMappedImage<float, 3>::Open(mapped, path);
+	}
+	std::remove(path);
+
+	return f;
+}
+
+/**
+ * 点データの読み込みの確認
+ * @return	正しければ true
+ */
+static bool
+CheckLoader()
+{
+	const char* binary = "check_points.bin";
+	const char* csv = "check_points.csv";
+	std::vector<Point> points = Random(200000, 27);
+
+	std::FILE* file = std::fopen(binary, "wb");
+	if (!file) return false;
+	std::fwrite(points.data(), sizeof(Point), points.size(), file);
+	std::fclose(file);
+
+	file = std::fopen(csv, "w");
+	if (!file) return false;
+	std::fprintf(file, "x,y,z\n");
+	for (const auto& p : points) std::fprintf(file, "%g,%g,%g\n", p[0], p[1], p[2]);
+	std::fclose(file);
+
+	bool f(true);
+	for (size_t t(1); t <= 4; t += 3) {
+		std::vector<Point> output;
+		f = f && ys::KDPointLoader<float, 3>::LoadBinary(binary, output, t) && output == points;
+		output.clear();
+		f = f && ys::KDPointLoader<float, 3>::LoadCsv(csv, output, t, ',', true) && output == points;
+	}
+
+	std::remove(binary);
+	std::remove(csv);
+
+	return f;
+}
+
+/**
+ * メモリ予算を超えるデータからの構築の確認
+ * @return	正しければ true
+ */
+static bool
+CheckExternalBuilder()
+{
+	const char* input = "check_input.bin";
+	const char* output = "check_output.bin";
+	std::vector<Point> points = Random(50000, 28);
+
+	std::FILE* file = std::fopen(input, "wb");
+	if (!file) return false;
+	std::fwrite(points.data(), sizeof(Point), points.size(), file);
+	std::fclose(file);
+
+	// 予算は点の1割程度なので、ファイル上での分割を経由する
+	ys::KDExternalBuilder<float, 3> builder;
+	ys::KDSearchArray<float, 3> tree;
+	bool f = builder.build(input, output, 100000, true) && ys::KDMappedImage<float, 3>::Open(tree, output);
+	f = f && tree.size() == points.size();
+	for (size_t i(0); f && i < 20; ++i) {
+		Point from = {{(float)(i * 4), 20.0f, (float)(i * 2)}};
+		Point to = {{from[0] + 30.0f, 70.0f, from[2] + 45.0f}};
+		std::vector<size_t> a, b;
+		tree.find(from, to, a);
+		tree.find(points.data(), from, to, b);
+		f = Sorted(a) == Brute(points, from, to) && Sorted(b) == Brute(points, from, to);
+	}
+	tree = ys::KDSearchArray<float, 3>();
+
+	std::remove(input);
+	std::remove(output);
+
+	return f;
+}
+
+/**
+ * ページに分割したファイルの確認
+ * @return	正しければ true
+ * @note	ファイルの大きさが点の数に比例する (容量や空の段に比例しない) ことも確かめる。
+ */
+static bool
+CheckPagedArray()
+{
+	const char* path = "check_paged.bin";
+	const size_t lengths[] = {1, 1000, 65536, 100000};
+
+	bool f(true);
+	for (size_t n : lengths) {
+		std::vector<Point> points = Random(n, 29);
+		ys::KDSearchArray<float, 3> tree;
+		ys::KDPagedArray<float, 3> paged;
+		f = f && tree.prepare(points.data(), n) && ys::KDPagedArray<float, 3>::Save(path, tree, points.data());
+
+		std::FILE* file = f ? std::fopen(path, "rb") : 0;
+		if (file) {
+			std::fseek(file, 0, SEEK_END);
+			size_t s = (size_t)std::ftell(file);
+			std::fclose(file);
+			// 最も深い段がほぼ空 (2のべき乗個の点) でも、ページの使用率は1/4を下回らない
+			f = s <= 4 * n * (sizeof(uint64_t) + sizeof(Point)) + 2 * 4096;
+		}
+
+		f = f && paged.open(path, 8 * 4096) && paged.size() == n;
+		for (size_t i(0); f && i < 20; ++i) {
+			Point from = {{(float)(i * 4), (float)(i * 3), 0.0f}};
+			Point to = {{from[0] + 25.0f, from[1] + 35.0f, 99.0f}};
+			std::vector<size_t> output;
+			f = paged.find(from, to, output) && Sorted(output) == Brute(points, from, to);
+		}
+	}
+	std::remove(path);
+
+	return f;
+}
+
+/**
+ * 点を追加できるkD木の確認
+ * @return	正しければ true
+ */
+static bool
+CheckDynamicArray()
+{
+	std::vector<Point> points = Random(3000, 30);
+	ys::KDDynamicArray<float, 3> tree;
+
+	// 1点ずつの追加と一括追加を混ぜる
+	bool f(true);
+	for (size_t i(0); f && i < points.size();) {
+		if (i % 7 == 0 && i + 100 <= points.size()) {
+			f = tree.insert(points.data() + i, 100);
+			i += 100;
+		}
+		else {
+			f = tree.insert(points[i]) == i;
+			++i;
+		}
+	}
+	f = f && tree.size() == points.size();
+
+	for (size_t i(0); f && i < 20; ++i) {
+		Point from = {{(float)(i * 4), 10.0f, (float)(i * 3)}};
+		Point to = {{from[0] + 35.0f, 80.0f, from[2] + 30.0f}};
+		std::vector<size_t> output;
+		tree.find(from, to, output);
+		f = Sorted(output) == Brute(points, from, to);
+	}
+
+	return f;
+}
+
+/**
+ * 点の削除の確認
+ * @return	正しければ true
+ */
+static bool
+CheckErase()
+{
+	std::vector<Point> points = Random(5000, 31);
+	std::vector<bool> dead(points.size(), false);
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	// 削除済みの割合の閾値を超えて部分木が作り直されるまで消す
+	std::mt19937 mt(31);
+	bool f(true);
+	for (size_t i(0); f && i < 3000; ++i) {
+		size_t k = mt() % points.size();
+		f = tree.erase(points.data(), k) != dead[k];
+		dead[k] = true;
+		f = f && tree.erased(k);
+		f = f && !tree.erase(points.data(), points.size());
+		if (i % 500 != 499) continue;
+
+		for (size_t j(0); f && j < 10; ++j) {
+			Point from = {{(float)(j * 8), 0.0f, (float)(j * 5)}};
+			Point to = {{from[0] + 30.0f, 99.0f, from[2] + 40.0f}};
+			std::vector<size_t> output;
+			tree.find(points.data(), from, to, output);
+			f = Sorted(output) == Brute(points, from, to, dead);
+		}
+	}
+
+	f = f && tree.compact(points.data());
+	Point from = {{0.0f, 0.0f, 0.0f}};
+	Point to = {{99.0f, 99.0f, 99.0f}};
+	std::vector<size_t> output;
+	tree.find(points.data(), from, to, output);
+
+	return f && Sorted(output) == Brute(points, from, to, dead);
+}
+
+/**
+ * 点の移動後の修正の確認
+ * @return	正しければ true
+ */
+static bool
+CheckRefit()
+{
+	std::vector<Point> points = Random(4000, 32);
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	std::mt19937 mt(32);
+	bool f(true);
+	for (size_t r(0); f && r < 5; ++r) {
+		// 一部の点だけを少し、さらに一部の点を大きく動かす
+		for (size_t i(0); i < points.size(); i += 3) {
+			points[i][mt() % 3] += (float)((int)(mt() % 5) - 2);
+		}
+		for (size_t i(0); i < 50; ++i) points[mt() % points.size()][mt() % 3] = (float)(mt() % 100);
+
+		size_t rebuilt(0);
+		f = tree.refit(points.data(), &rebuilt) && rebuilt <= points.size();
+		for (size_t j(0); f && j < 10; ++j) {
+			Point from = {{(float)(j * 7), (float)(j * 4), 5.0f}};
+			Point to = {{from[0] + 30.0f, from[1] + 40.0f, 90.0f}};
+			std::vector<size_t> output;
+			tree.find(points.data(), from, to, output);
+			f = Sorted(output) == Brute(points, from, to);
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 探索を止めない作り直しの確認
+ * @return	正しければ true
+ * @note	例外を出す探索の後始末、作り直し中の探索、登録数の上限を超える探索を確かめる。
+ */
+static bool
+CheckSearchHandle()
+{
+	const Point from = {{10.0f, 20.0f, 30.0f}};
+	const Point to = {{60.0f, 70.0f, 80.0f}};
+	std::vector<Point> a = Random(3000, 33);
+	std::vector<Point> b = Random(4000, 34);
+	std::vector<size_t> ea = Brute(a, from, to);
+	std::vector<size_t> eb = Brute(b, from, to);
+
+	ys::KDSearchHandle<float, 3> handle;
+	std::vector<Point> v(a);
+	bool f = handle.rebuild(std::move(v));
+
+	// 例外を出した探索の登録が残っていれば、登録数の上限で詰まる
+	for (size_t i(0); i < 200; ++i) {
+		try {
+			handle.read([] (const ys::KDSearchArray<float, 3>&, const Point*) { throw std::runtime_error("check"); });
+		}
+		catch (const std::runtime_error&) {
+			;
+		}
+	}
+
+	std::vector<size_t> output;
+	f = f && handle.find(from, to, output) && Sorted(output) == ea;
+
+	// 作り直しの間も、探索結果は古い版か新しい版のどちらか
+	std::atomic<bool> done(false);
+	std::atomic<bool> ok(true);
+	std::vector<std::thread> workers;
+	for (size_t i(0); i < 4; ++i) {
+		workers.push_back(std::thread([&] () {
+					while (!done.load()) {
+						std::vector<size_t> o;
+						handle.find(from, to, o);
+						std::sort(o.begin(), o.end());
+						if (o != ea && o != eb) ok.store(false);
+					}
+				}));
+	}
+	v = b;
+	f = f && handle.rebuild_async(std::move(v));
+	handle.wait();
+	done.store(true);
+	for (auto& w : workers) w.join();
+	workers.clear();
+
+	// 登録数の上限 (128) まで探索中のスレッドを止めておき、さらに探索する
+	std::atomic<size_t> inside(0);
+	done.store(false);
+	for (size_t i(0); i < 128; ++i) {
+		workers.push_back(std::thread([&] () {
+					handle.read([&] (const ys::KDSearchArray<float, 3>&, const Point*) {
+							++inside;
+							while (!done.load()) std::this_thread::yield();
+						});
+				}));
+	}
+	while (inside.load() < 128) std::this_thread::yield();
+	output.clear();
+	f = f && handle.find(from, to, output) && Sorted(output) == eb;
+	done.store(true);
+	for (auto& w : workers) w.join();
+
+	return f && ok.load();
+}
+
+/**
+ * kD木の移動と共有の確認
+ * @return	正しければ true
+ */
+static bool
+CheckMoveAndShare()
+{
+	const Point from = {{5.0f, 15.0f, 25.0f}};
+	const Point to = {{55.0f, 65.0f, 75.0f}};
+	std::vector<Point> points = Random(3000, 34);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> a;
+	if (!a.prepare(points.data(), points.size())) return false;
+	for (size_t i(0); i < points.size(); i += 5) {
+		a.erase(points.data(), i);
+		dead[i] = true;
+	}
+	std::vector<size_t> expected = Brute(points, from, to, dead);
+
+	// 移動元は空になり、削除済みの印も一緒に移る
+	ys::KDSearchArray<float, 3> b(std::move(a));
+	bool f = a.capacity() == 0 && b.size() == points.size();
+	std::vector<size_t> output;
+	b.find(points.data(), from, to, output);
+	f = f && Sorted(output) == expected;
+
+	ys::KDSearchArray<float, 3> c;
+	c = std::move(b);
+	output.clear();
+	c.find(points.data(), from, to, output);
+	f = f && Sorted(output) == expected;
+
+	// 共有した木を複数のスレッドから同時に探索する
+	std::shared_ptr<const ys::KDSearchArray<float, 3> > shared = ys::KDSearchArray<float, 3>::Share(std::move(c));
+	f = f && shared && c.capacity() == 0;
+	std::atomic<bool> ok(true);
+	std::vector<std::thread> workers;
+	for (size_t i(0); f && i < 4; ++i) {
+		workers.push_back(std::thread([&, shared] () {
+					for (size_t j(0); j < 20; ++j) {
+						std::vector<size_t> o;
+						shared->find(points.data(), from, to, o);
+						if (Sorted(o) != expected) ok.store(false);
+					}
+				}));
+	}
+	for (auto& w : workers) w.join();
+
+	return f && ok.load();
+}
+
+static size_t outstanding(0);	///< CountingAllocator で確保中のバイト数
+
+/**
+ * 確保中のバイト数を数えるアロケータ
+ */
+template<typename T>
+struct CountingAllocator
+{
+	typedef T value_type;
+
+	CountingAllocator() {}
+
+	template<typename U>
+	CountingAllocator(const CountingAllocator<U>&) {}
+
+	T*
+	allocate(size_t n)
+	{
+		outstanding += n * sizeof(T);
+		return std::allocator<T>().allocate(n);
+	}
+
+	void
+	deallocate(T* p,
+			   size_t n)
+	{
+		outstanding -= n * sizeof(T);
+		std::allocator<T>().deallocate(p, n);
+	}
+
+	template<typename U>
+	bool operator ==(const CountingAllocator<U>&) const { return true; }
+
+	template<typename U>
+	bool operator !=(const CountingAllocator<U>&) const { return false; }
+};
+
+/**
+ * 構築用の作業領域の確認
+ * @return	正しければ true
+ * @note	予約しなければ構築後に作業領域が残らず、予約すれば @a release まで残ることを確かめる。
+ */
+static bool
+CheckBuildBuffer()
+{
+	const Point from = {{10.0f, 10.0f, 10.0f}};
+	const Point to = {{60.0f, 60.0f, 60.0f}};
+	std::vector<Point> points = Random(5000, 35);
+	std::vector<size_t> expected = Brute(points, from, to);
+	std::vector<size_t> output;
+
+	size_t base = outstanding;
+	bool f(true);
+	{
+		ys::KDSearchArray<float, 3, CountingAllocator<size_t> > tree;
+		f = f && tree.prepare(points.data(), points.size());
+		f = f && outstanding - base == tree.capacity() * sizeof(size_t);
+
+		f = f && tree.reserve(points.size());
+		f = f && tree.prepare(points.data(), points.size());
+		f = f && outstanding - base == (tree.capacity() + points.size()) * sizeof(size_t);
+		tree.find(points.data(), from, to, output);
+		f = f && Sorted(output) == expected;
+
+		tree.release();
+		f = f && outstanding - base == tree.capacity() * sizeof(size_t);
+		f = f && tree.prepare(points.data(), points.size());
+		f = f && outstanding - base == tree.capacity() * sizeof(size_t);
+	}
+
+	return f && outstanding == base;
+}
+
+/**
+ * アリーナから確保した多数の小さなkD木の確認
+ * @return	正しければ true
+ * @note	アリーナを @a reset して作り直した木も正しく探索できることを確かめる。
+ */
+static bool
+CheckArena()
+{
+	typedef ys::KDSearchArray<float, 3, ys::KDArenaAllocator<size_t> > Tree;
+
+	const Point from = {{20.0f, 20.0f, 20.0f}};
+	const Point to = {{80.0f, 80.0f, 80.0f}};
+	ys::KDArena arena(1 << 12);
+	bool f(true);
+	for (unsigned int round(0); f && round < 2; ++round) {
+		std::vector<std::vector<Point> > points;
+		std::vector<std::unique_ptr<Tree> > trees;
+		for (unsigned int i(0); i < 50; ++i) {
+			points.push_back(Random(10 + i * 7, 100 + i + round));
+			trees.push_back(std::unique_ptr<Tree>(new Tree(ys::KDArenaAllocator<size_t>(&arena))));
+			f = f && trees.back()->prepare(points.back().data(), points.back().size());
+		}
+		for (size_t i(0); f && i < trees.size(); ++i) {
+			std::vector<size_t> output;
+			trees[i]->find(points[i].data(), from, to, output);
+			f = Sorted(output) == Brute(points[i], from, to);
+		}
+		trees.clear();
+		arena.reset();
+	}
+
+	return f;
+}
+
+/**
+ * NUMAノードごとの複製の確認
+ * @return	正しければ true
+ * @note	構築の後も、呼び出したスレッドのCPUの割り当てが変わらないことを確かめる。
+ */
+static bool
+CheckNumaReplicas()
+{
+	std::vector<Point> points = Random(20000, 36);
+
+#ifdef	__linux__
+	cpu_set_t before;
+	if (::sched_getaffinity(0, sizeof(before), &before) != 0) return false;
+#endif	// __linux__
+
+	ys::KDNumaReplicas<float, 3> replicas;
+	bool f = replicas.prepare(points.data(), points.size()) && 0 < replicas.replicas();
+
+#ifdef	__linux__
+	cpu_set_t after;
+	f = f && ::sched_getaffinity(0, sizeof(after), &after) == 0 && CPU_EQUAL(&before, &after);
+#endif	// __linux__
+
+	std::mt19937 mt(36);
+	for (size_t i(0); f && i < 20; ++i) {
+		Point from, to;
+		for (size_t j(0); j < 3; ++j) {
+			float a = (float)(mt() % 100);
+			float b = (float)(mt() % 100);
+			from[j] = std::min(a, b);
+			to[j] = std::max(a, b);
+		}
+		std::vector<size_t> output;
+		replicas.find(from, to, output);
+		f = Sorted(output) == Brute(points, from, to);
+	}
+
+	return f;
+}
+
+/**
+ * 巨大ページから確保したkD木の確認
+ * @return	正しければ true
+ * @note	kD木の本体が2MBを超えるので、mmap で確保した領域を使う。
+ */
+static bool
+CheckHugePages()
+{
+	const Point from = {{30.0f, 0.0f, 45.0f}};
+	const Point to = {{40.0f, 100.0f, 55.0f}};
+	std::vector<Point> points = Random(300000, 37);
+
+	ys::KDNumaReplicas<float, 3, ys::KDHugePageAllocator<size_t> > replicas;
+	if (!replicas.prepare(points.data(), points.size())) return false;
+
+	std::vector<size_t> output;
+	replicas.find(from, to, output);
+
+	return Sorted(output) == Brute(points, from, to);
+}
+
+/**
+ * 座標を引き取ったkD木の確認
+ * @return	正しければ true
+ * @note	準備に渡した配列を壊した後も探索でき、削除と移動の後も全探索と一致することを確かめる。
+			引き取る座標の範囲 (Extent) が実際に使われる最大のインデックスと一致することも確かめる。
+ */
+static bool
+CheckOwned()
+{
+	for (size_t n(1); n < 300; ++n) {
+		std::vector<Point> small = Random(n, n);
+		ys::KDSearchArray<float, 3> t;
+		if (!t.prepare(small.data(), small.size())) return false;
+		size_t e(0);
+		for (size_t i(0); i < t.capacity(); ++i) {
+			if (t.at(i) < ~0LU) e = i + 1;
+		}
+		if (e != ys::KDSearchArray<float, 3>::Extent(n)) return false;
+	}
+
+	std::vector<Point> points = Random(6000, 38);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> tree;
+	{
+		std::vector<Point> copy(points);
+		if (!tree.prepare_owned(copy.data(), copy.size())) return false;
+		std::fill(copy.begin(), copy.end(), Point());
+	}
+
+	std::mt19937 mt(38);
+	bool f(true);
+	for (size_t r(0); f && r < 4; ++r) {
+		if (r == 2) {
+			// 座標を更新して引き取った座標も合わせる
+			for (size_t i(0); i < points.size(); i += 4) points[i][mt() % 3] = (float)(mt() % 100);
+			f = tree.refit(points.data());
+		}
+		else {
+			// 部分木の作り直しが起きる程度に削除する
+			for (size_t i(0); i < 1000; ++i) {
+				size_t k = mt() % points.size();
+				if (!dead[k]) f = f && tree.erase(k);
+				dead[k] = true;
+			}
+		}
+		for (size_t j(0); f && j < 10; ++j) {
+			Point from = {{(float)(j * 5), (float)(j * 3), 10.0f}};
+			Point to = {{from[0] + 40.0f, from[1] + 50.0f, 80.0f}};
+			std::vector<size_t> output;
+			tree.find(from, to, output);
+			f = Sorted(output) == Brute(points, from, to, dead);
+		}
+		for (size_t i(ys::KDSearchArray<float, 3>::Extent(points.size())); f && i < tree.capacity(); ++i) {
+			f = tree.at(i) == ~0LU;	// 作り直しても範囲の外は使わない
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 付加情報付きのkD木の確認
+ * @return	正しければ true
+ * @note	付加情報を点のインデックスから決め、削除・移動の後も点と付加情報が対応することを確かめる。
+ */
+static bool
+CheckPayloads()
+{
+	typedef ys::KDPayloadArray<float, 3, size_t> Tree;
+
+	// 付加情報を揃えない KDSearchArray の操作は使えない
+	static_assert(!std::is_convertible<Tree*, ys::KDSearchArray<float, 3>*>::value, "KDPayloadArray must not expose KDSearchArray");
+
+	std::vector<Point> points = Random(6000, 39);
+	std::vector<size_t> payloads(points.size());
+	for (size_t i(0); i < payloads.size(); ++i) payloads[i] = i * 3 + 1;
+	std::vector<bool> dead(points.size(), false);
+
+	Tree tree;
+	if (!tree.prepare(points.data(), payloads.data(), points.size())) return false;
+
+	std::mt19937 mt(39);
+	bool f(true);
+	for (size_t r(0); f && r < 4; ++r) {
+		if (r == 2) {
+			for (size_t i(0); i < points.size(); i += 4) points[i][mt() % 3] = (float)(mt() % 100);
+			f = tree.refit(points.data());
+		}
+		else {
+			for (size_t i(0); i < 1000; ++i) {
+				size_t k = mt() % points.size();
+				if (!dead[k]) f = f && tree.erase(k);
+				dead[k] = true;
+			}
+			f = f && tree.compact();
+		}
+		for (size_t j(0); f && j < 10; ++j) {
+			Point from = {{(float)(j * 5), (float)(j * 3), 10.0f}};
+			Point to = {{from[0] + 40.0f, from[1] + 50.0f, 80.0f}};
+			std::vector<size_t> output, attached;
+			tree.find(from, to, output, attached);
+			f = output.size() == attached.size();
+			for (size_t i(0); f && i < output.size(); ++i) f = attached[i] == output[i] * 3 + 1;
+			f = f && Sorted(output) == Brute(points, from, to, dead);
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 集計付きのkD木の確認
+ * @return	正しければ true
+ * @note	点数・総和・最小値・最大値を全探索の集計と比べる (値は整数なので総和も一致する)。
+ */
+static bool
+CheckAggregate()
+{
+	typedef ys::KDSummary<double> Summary;
+
+	std::vector<Point> points = Random(8000, 40);
+	std::vector<Summary> values(points.size());
+	for (size_t i(0); i < points.size(); ++i) values[i] = Summary::Of((double)(i % 1000));
+
+	ys::KDAggregateArray<float, 3, Summary> tree;
+	if (!tree.prepare(points.data(), values.data(), points.size())) return false;
+
+	std::mt19937 mt(40);
+	bool f(tree.size() == points.size());
+	for (size_t j(0); f && j < 30; ++j) {
+		Point from, to;
+		for (size_t i(0); i < 3; ++i) {
+			float a = (float)(mt() % 100);
+			float b = (float)(mt() % 100);
+			from[i] = std::min(a, b);
+			to[i] = std::max(a, b);
+		}
+		Summary e = Summary::Identity();
+		for (size_t i : Brute(points, from, to)) e = Summary::Combine(e, values[i]);
+
+		Summary a = tree.aggregate(from, to);
+		f = a.count == e.count && a.sum == e.sum && a.min == e.min && a.max == e.max;
+	}
+
+	return f;
+}
+
+/**
+ * 分類を指定した探索の確認
+ * @return	正しければ true
+ * @note	削除で部分木を作り直した後も、分類のビットマスクによる枝刈りが正しいことを確かめる。
+ */
+static bool
+CheckCategories()
+{
+	const Point from = {{10.0f, 5.0f, 0.0f}};
+	const Point to = {{70.0f, 90.0f, 60.0f}};
+	std::vector<Point> points = Random(6000, 41);
+	std::vector<uint64_t> categories(points.size());
+	std::vector<bool> dead(points.size(), false);
+	std::mt19937 mt(41);
+	for (size_t i(0); i < points.size(); ++i) {
+		categories[i] = (uint64_t)1 << (i < 3000 ? mt() % 4 : 4 + mt() % 4);	// 前半と後半で分類を分ける
+	}
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size()) || !tree.categorize(categories.data())) return false;
+
+	bool f(true);
+	for (size_t r(0); f && r < 2; ++r) {
+		for (uint64_t mask : {(uint64_t)0x1, (uint64_t)0x30, (uint64_t)0x81, (uint64_t)0x100}) {
+			std::vector<size_t> expected;
+			for (size_t i : Brute(points, from, to, dead)) {
+				if (categories[i] & mask) expected.push_back(i);
+			}
+			std::vector<size_t> output;
+			tree.find(points.data(), from, to, mask, output);
+			f = f && Sorted(output) == expected;
+		}
+		for (size_t i(0); i < 1500; ++i) {
+			size_t k = mt() % points.size();
+			if (!dead[k]) f = f && tree.erase(points.data(), k);
+			dead[k] = true;
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 全探索による近傍探索
+ * @param[in]	points	点
+ * @param[in]	query	探索の中心
+ * @param[in]	dead	削除済みの点 (空なら削除無し)
+ * @return	(距離の2乗, インデックス) の組 (近い順)
+ */
+static std::vector<std::pair<double, size_t> >
+Nearest(const std::vector<Point>& points,
+		const Point& query,
+		const std::vector<bool>& dead = std::vector<bool>())
+{
+	std::vector<std::pair<double, size_t> > all;
+	for (size_t i(0); i < points.size(); ++i) {
+		if (!dead.empty() && dead[i]) continue;
+		double s(0.0);
+		for (size_t j(0); j < 3; ++j) s += ((double)points[i][j] - query[j]) * ((double)points[i][j] - query[j]);
+		all.push_back(std::make_pair(s, i));
+	}
+	std::sort(all.begin(), all.end());
+	return all;
+}
+
+/**
+ * 近傍探索 (厳密解と近似解) の確認
+ * @return	正しければ true
+ * @note	厳密解の距離は全探索と一致し、近似解の i 番目の距離は真の i 番目の距離の
+			1 + epsilon 倍以内で、上限を指定しても k 個返すことを確かめる (同じ距離の点があるので距離で比べる)。
+ */
+static bool
+CheckNearest()
+{
+	const size_t K = 8;
+	std::vector<Point> points = Random(5000, 42);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	std::mt19937 mt(42);
+	bool f(true);
+	for (size_t r(0); f && r < 2; ++r) {
+		for (size_t j(0); f && j < 30; ++j) {
+			Point q = {{(float)(mt() % 1000) / 10.0f, (float)(mt() % 1000) / 10.0f, (float)(mt() % 1000) / 10.0f}};
+			std::vector<std::pair<double, size_t> > e = Nearest(points, q, dead);
+
+			std::vector<std::pair<double, size_t> > output;
+			tree.nearest(points.data(), q, K, output);
+			f = output.size() == K;
+			for (size_t i(0); f && i < K; ++i) f = output[i].first == e[i].first && !dead[output[i].second];
+
+			for (double epsilon : {0.5, 1.0}) {
+				for (size_t checks : {(size_t)0, (size_t)64}) {
+					tree.nearest(points.data(), q, K, output, epsilon, checks);
+					f = f && output.size() == K;
+					for (size_t i(0); f && i < K && checks == 0; ++i) {
+						f = std::sqrt(output[i].first) <= std::sqrt(e[i].first) * (1.0 + epsilon) + 1e-9;
+					}
+					for (size_t i(0); f && i < K; ++i) f = !dead[output[i].second];
+				}
+			}
+		}
+		for (size_t i(0); i < 2000; ++i) {
+			size_t k = mt() % points.size();
+			if (!dead[k]) f = f && tree.erase(points.data(), k);
+			dead[k] = true;
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 無作為に回転したkD木の森の確認
+ * @return	正しければ true
+ * @note	上限無しなら距離が全探索と (回転の丸め誤差の範囲で) 一致し、
+			上限を指定しても重複の無い k 個の点を返すことを確かめる。
+ */
+static bool
+CheckForest()
+{
+	const size_t K = 8;
+	std::vector<Point> points = Random(4000, 43);
+
+	ys::KDForest<float, 3> forest;
+	if (!forest.prepare(points.data(), points.size(), 3) || forest.trees() != 3 || forest.size() != points.size()) return false;
+
+	std::mt19937 mt(43);
+	bool f(true);
+	for (size_t j(0); f && j < 30; ++j) {
+		Point q = {{(float)(mt() % 1000) / 10.0f, (float)(mt() % 1000) / 10.0f, (float)(mt() % 1000) / 10.0f}};
+		std::vector<std::pair<double, size_t> > e = Nearest(points, q);
+
+		std::vector<std::pair<double, size_t> > output;
+		forest.nearest(q, K, output);
+		f = output.size() == K;
+		for (size_t i(0); f && i < K; ++i) f = std::fabs(output[i].first - e[i].first) <= 1e-6 * (1.0 + e[i].first);
+
+		forest.nearest(q, K, output, 0.0, 32);
+		std::vector<size_t> ids;
+		for (const auto& n : output) ids.push_back(n.second);
+		ids = Sorted(ids);
+		f = f && output.size() == K && std::unique(ids.begin(), ids.end()) == ids.end();
+	}
+
+	return f;
+}
+
+/**
+ * 近い順に取り出す反復子の確認
+ * @return	正しければ true
+ * @note	削除済みの点を除いた全ての点が、全探索と同じ距離の順に1回ずつ出てくることを確かめる。
+ */
+static bool
+CheckNearestIterator()
+{
+	std::vector<Point> points = Random(3000, 44);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare_owned(points.data(), points.size())) return false;
+	std::mt19937 mt(44);
+	for (size_t i(0); i < 800; ++i) {
+		size_t k = mt() % points.size();
+		if (!dead[k] && !tree.erase(k)) return false;
+		dead[k] = true;
+	}
+
+	bool f(true);
+	for (size_t j(0); f && j < 5; ++j) {
+		Point q = {{(float)(mt() % 100), (float)(mt() % 100), (float)(mt() % 100)}};
+		std::vector<std::pair<double, size_t> > e = Nearest(points, q, dead);
+
+		ys::KDNearestIterator<float, 3> it(tree, 0, q);
+		std::vector<std::pair<double, size_t> > output;
+		it.next(10, output);	// 1ページ目を取り出してから残りを続ける
+		std::pair<double, size_t> n;
+		while (it.next(n)) output.push_back(n);
+
+		f = output.size() == e.size();
+		std::vector<size_t> ids;
+		for (size_t i(0); f && i < output.size(); ++i) {
+			f = output[i].first == e[i].first;
+			ids.push_back(output[i].second);
+		}
+		std::vector<size_t> all;
+		for (const auto& x : e) all.push_back(x.second);
+		f = f && Sorted(ids) == Sorted(all);
+	}
+
+	return f;
+}
+
+/**
+ * 距離を指定した近傍探索と半径内の探索の確認
+ * @param[in]	points	点
+ * @param[in]	queries	探索の中心
+ * @param[in]	metric	距離
+ * @param[in]	radius	半径 (実距離)
+ * @return	正しければ true
+ * @note	近傍の順位付け用の距離と半径内の点を、同じ距離による全探索と比べる。
+ */
+template<size_t D, typename METRIC>
+static bool
+CheckMetric(const std::vector<std::array<float, D> >& points,
+			const std::vector<std::array<float, D> >& queries,
+			const METRIC& metric,
+			double radius)
+{
+	const size_t K = 6;
+
+	ys::KDSearchArray<float, D> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	bool f(true);
+	for (size_t j(0); f && j < queries.size(); ++j) {
+		std::vector<double> e;
+		std::vector<size_t> inside;
+		for (size_t i(0); i < points.size(); ++i) {
+			double s = metric.distance(queries[j], points[i]);
+			e.push_back(s);
+			if (s <= metric.rank(radius)) inside.push_back(i);
+		}
+		std::sort(e.begin(), e.end());
+
+		std::vector<std::pair<double, size_t> > output;
+		tree.nearest(points.data(), queries[j], K, output, 0.0, 0, metric);
+		f = output.size() == K;
+		for (size_t i(0); f && i < K; ++i) f = output[i].first == e[i];
+
+		std::vector<size_t> within;
+		tree.within(points.data(), queries[j], radius, within, metric);
+		f = f && Sorted(within) == inside;
+	}
+
+	return f;
+}
+
+/**
+ * 距離を選べる近傍探索の確認
+ * @return	正しければ true
+ * @note	L1, L∞, 重み付きL2, 大円距離で確かめる。
+ */
+static bool
+CheckMetrics()
+{
+	std::vector<Point> points = Random(3000, 45);
+	std::vector<Point> queries = Random(20, 46);
+
+	const std::array<double, 3> weights = {{1.0, 4.0, 0.25}};
+	bool f = CheckMetric(points, queries, ys::KDManhattan<float, 3>(), 20.0)
+		&& CheckMetric(points, queries, ys::KDChebyshev<float, 3>(), 10.0)
+		&& CheckMetric(points, queries, ys::KDWeightedEuclidean<float, 3>(weights), 15.0);
+
+	// (緯度, 経度) は日付変更線と極の近くも含める
+	std::mt19937 mt(45);
+	std::vector<std::array<float, 2> > places(3000), centers(20);
+	for (auto& p : places) p = {{(float)((int)(mt() % 1780) - 890) / 10.0f, (float)((int)(mt() % 3600) - 1800) / 10.0f}};
+	for (auto& c : centers) c = {{(float)((int)(mt() % 1780) - 890) / 10.0f, (float)((int)(mt() % 3600) - 1800) / 10.0f}};
+	centers[0] = {{0.0f, 179.5f}};
+	centers[1] = {{88.0f, -20.0f}};
+
+	return f && CheckMetric(places, centers, ys::KDHaversine<float, 2>(), 1500000.0);
+}
+
+/**
+ * 周期境界の探索の確認
+ * @return	正しければ true
+ * @note	境界を回り込む範囲の探索と、周期境界の距離による近傍・半径内の探索を全探索と比べる
+			(次元0と2は周期100、次元1は周期無し)。
+ */
+static bool
+CheckPeriodic()
+{
+	std::vector<Point> points = Random(4000, 47);
+	std::vector<Point> queries = Random(20, 48);
+	queries[0] = {{1.0f, 50.0f, 99.0f}};	// 角の近く
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	std::mt19937 mt(47);
+	bool f(true);
+	for (size_t j(0); f && j < 20; ++j) {
+		Point from, to;
+		for (size_t i(0); i < 3; ++i) {
+			from[i] = (float)(mt() % 100);
+			to[i] = (float)(mt() % 100);
+		}
+		std::vector<size_t> expected;
+		for (size_t i(0); i < points.size(); ++i) {
+			bool g(true);
+			for (size_t d(0); d < 3 && g; ++d) {
+				g = from[d] <= to[d]
+					? from[d] <= points[i][d] && points[i][d] <= to[d]
+					: from[d] <= points[i][d] || points[i][d] <= to[d];
+			}
+			if (g) expected.push_back(i);
+		}
+		std::vector<size_t> output;
+		tree.find_periodic(points.data(), from, to, output);
+		f = Sorted(output) == expected;
+	}
+
+	const std::array<double, 3> lower = {{0.0, 0.0, 0.0}};
+	const std::array<double, 3> length = {{100.0, 0.0, 100.0}};
+
+	return f && CheckMetric(points, queries, ys::KDPeriodic<float, 3>(lower, length), 12.0);
+}
+
+/**
+ * 半径内の全ての点の組 (自己結合) の確認
+ * @return	正しければ true
+ * @note	1スレッドと複数スレッドで、削除済みの点を除いた組が全探索と一致し、
+			各組が1回だけ出てくることを確かめる。
+ */
+static bool
+CheckSelfJoin()
+{
+	const double R = 4.0;
+	std::vector<Point> points = Random(3000, 49);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+	for (size_t i(0); i < points.size(); i += 7) {
+		if (!tree.erase(points.data(), i)) return false;
+		dead[i] = true;
+	}
+
+	std::vector<std::pair<size_t, size_t> > expected;
+	for (size_t i(0); i < points.size(); ++i) {
+		for (size_t j(i + 1); j < points.size(); ++j) {
+			if (dead[i] || dead[j]) continue;
+			double s(0.0);
+			for (size_t d(0); d < 3; ++d) s += ((double)points[i][d] - points[j][d]) * ((double)points[i][d] - points[j][d]);
+			if (s <= R * R) expected.push_back(std::make_pair(i, j));
+		}
+	}
+
+	ys::KDDualTree<float, 3> dual(tree, points.data());
+	if (!dual.prepare()) return false;
+
+	bool f(!expected.empty());
+	for (size_t threads : {(size_t)1, (size_t)4}) {
+		std::mutex mutex;
+		std::vector<std::pair<size_t, size_t> > output;
+		dual.all_pairs_within(R, [&] (size_t a, size_t b) {
+				std::lock_guard<std::mutex> lock(mutex);
+				output.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+			}, threads);
+		std::sort(output.begin(), output.end());
+		f = f && output == expected;
+	}
+
+	return f;
+}
+
+/**
+ * 2つのkD木の空間結合の確認
+ * @return	正しければ true
+ * @note	半径 (L1距離) と次元ごとの許容範囲の述語で、(@a a の点, @a b の点) の組が全探索と一致することを確かめる。
+ */
+static bool
+CheckJoin()
+{
+	std::vector<Point> a = Random(2000, 50);
+	std::vector<Point> b = Random(2500, 51);
+
+	ys::KDSearchArray<float, 3> ta, tb;
+	if (!ta.prepare(a.data(), a.size()) || !tb.prepare_owned(b.data(), b.size())) return false;
+	ys::KDDualTree<float, 3> da(ta, a.data());
+	ys::KDDualTree<float, 3> db(tb, 0);
+	if (!da.prepare() || !db.prepare()) return false;
+
+	const ys::KDWithinPredicate<float, 3, ys::KDManhattan<float, 3> > within(6.0);
+	const Point tolerance = {{1.0f, 3.0f, 0.0f}};
+	const ys::KDBoxPredicate<float, 3> box(tolerance);
+
+	std::vector<std::pair<size_t, size_t> > e1, e2;
+	for (size_t i(0); i < a.size(); ++i) {
+		for (size_t j(0); j < b.size(); ++j) {
+			if (within(a[i], b[j])) e1.push_back(std::make_pair(i, j));
+			if (box(a[i], b[j])) e2.push_back(std::make_pair(i, j));
+		}
+	}
+
+	std::mutex mutex;
+	std::vector<std::pair<size_t, size_t> > o1, o2;
+	ys::KDDualTree<float, 3>::Join(da, db, within, [&] (size_t i, size_t j) {
+			std::lock_guard<std::mutex> lock(mutex);
+			o1.push_back(std::make_pair(i, j));
+		}, 3);
+	ys::KDDualTree<float, 3>::Join(da, db, box, [&] (size_t i, size_t j) {
+			std::lock_guard<std::mutex> lock(mutex);
+			o2.push_back(std::make_pair(i, j));
+		}, 1);
+	std::sort(o1.begin(), o1.end());
+	std::sort(o2.begin(), o2.end());
+
+	return !e1.empty() && !e2.empty() && o1 == e1 && o2 == e2;
+}
+
+/**
+ * 全ての点の近傍探索 (dual-tree) の確認
+ * @return	正しければ true
+ * @note	自己結合 (自身を除く) と別の点の集合に対する探索の距離が全探索と一致し、
+			参照点が k 個に足りない場合は (無限大, ~0LU) で埋めることを確かめる。
+ */
+static bool
+CheckAllNearest()
+{
+	const size_t K = 5;
+	std::vector<Point> points = Random(2000, 52);
+	std::vector<Point> queries = Random(500, 53);
+	std::vector<Point> few = Random(3, 54);
+
+	ys::KDSearchArray<float, 3> tp, tq, tf;
+	if (!tp.prepare(points.data(), points.size()) || !tq.prepare(queries.data(), queries.size()) ||
+		!tf.prepare(few.data(), few.size())) return false;
+	ys::KDDualTree<float, 3> dp(tp, points.data());
+	ys::KDDualTree<float, 3> dq(tq, queries.data());
+	ys::KDDualTree<float, 3> df(tf, few.data());
+	if (!dp.prepare() || !dq.prepare() || !df.prepare()) return false;
+
+	bool f(true);
+	std::vector<std::pair<double, size_t> > output;
+	for (size_t threads : {(size_t)1, (size_t)4}) {
+		f = f && dp.all_nearest(K, output, threads) && output.size() == points.size() * K;
+		for (size_t i(0); f && i < points.size(); ++i) {
+			std::vector<std::pair<double, size_t> > e = Nearest(points, points[i]);
+			e.erase(std::find(e.begin(), e.end(), std::make_pair(0.0, i)));
+			for (size_t j(0); f && j < K; ++j) f = output[i * K + j].first == e[j].first && output[i * K + j].second != i;
+		}
+	}
+
+	f = f && ys::KDDualTree<float, 3>::AllNearest(dq, dp, K, output) && output.size() == queries.size() * K;
+	for (size_t i(0); f && i < queries.size(); ++i) {
+		std::vector<std::pair<double, size_t> > e = Nearest(points, queries[i]);
+		for (size_t j(0); f && j < K; ++j) f = output[i * K + j].first == e[j].first;
+	}
+
+	f = f && ys::KDDualTree<float, 3>::AllNearest(dq, df, K, output) && output.size() == queries.size() * K;
+	for (size_t i(0); f && i < queries.size(); ++i) {
+		std::vector<std::pair<double, size_t> > e = Nearest(few, queries[i]);
+		for (size_t j(0); f && j < K; ++j) {
+			f = j < few.size()
+				? output[i * K + j].first == e[j].first
+				: output[i * K + j].second == ~0LU && std::isinf(output[i * K + j].first);
+		}
+	}
+
+	return f;
+}
+
+/**
+ * 前回の結果を起点にした近傍探索の確認
+ * @return	正しければ true
+ * @note	少しずつ動く探索の中心で、前回の @a hint を渡した結果が全探索と一致することを確かめる。
+			途中で点を削除して部分木を作り直し、範囲外の @a hint も渡す。
+ */
+static bool
+CheckWarmStart()
+{
+	const size_t K = 4;
+	std::vector<Point> points = Random(5000, 55);
+	std::vector<bool> dead(points.size(), false);
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+
+	std::mt19937 mt(55);
+	Point q = {{50.0f, 50.0f, 50.0f}};
+	size_t hint(~0LU);	// 範囲外なら根から探索する
+	bool f(true);
+	for (size_t j(0); f && j < 300; ++j) {
+		for (auto& x : q) x = std::min(99.0f, std::max(0.0f, x + (float)((int)(mt() % 21) - 10) / 10.0f));
+		if (j % 100 == 50) {
+			for (size_t i(0); i < 1000; ++i) {
+				size_t k = mt() % points.size();
+				if (!dead[k]) f = f && tree.erase(points.data(), k);
+				dead[k] = true;
+			}
+		}
+
+		std::vector<std::pair<double, size_t> > output;
+		tree.nearest_from(points.data(), q, K, output, hint);
+		std::vector<std::pair<double, size_t> > e = Nearest(points, q, dead);
+		f = f && output.size() == K && hint < tree.capacity() && tree.at(hint) < points.size();
+		f = f && Nearest(std::vector<Point>(1, points[tree.at(hint)]), q)[0].first == e[0].first;	// 最も近い点を返す
+		for (size_t i(0); f && i < K; ++i) f = output[i].first == e[i].first && !dead[output[i].second];
+	}
+
+	return f;
+}
+
+/**
+ * 範囲探索の結果を少しずつ取り出すカーソルの確認
+ * @return	正しければ true
+ * @note	ページ単位の取り出しが @a find と同じ順になることを、削除の前後で確かめる。
+			全て削除するとカーソルは最初から終わっている。
+ */
+static bool
+CheckRangeCursor()
+{
+	const Point from = {{10.0f, 0.0f, 20.0f}};
+	const Point to = {{70.0f, 80.0f, 90.0f}};
+	std::vector<Point> points = Random(5000, 56);
+
+	ys::KDSearchArray<float, 3> tree;
+	if (!tree.prepare(points.data(), points.size())) return false;
+	tree.set_threshold(0.99);	// 削除済みの点を木に残したまま探索する
+
+	bool f(true);
+	for (size_t r(0); f && r < 3; ++r) {
+		if (r == 1) {
+			for (size_t i(0); i < points.size(); ++i) {
+				if (points[i][0] < 50.0f) tree.erase(points.data(), i);
+			}
+		}
+		else if (r == 2) {
+			for (size_t i(0); i < points.size(); ++i) tree.erase(points.data(), i);
+		}
+
+		std::vector<size_t> expected;
+		tree.find(points.data(), from, to, expected);
+
+		ys::KDRangeCursor<float, 3> cursor(tree, points.data(), to, to);
+		cursor.reset(from, to);
+		std::vector<size_t> output;
+		while (cursor.next(7, output) == 7) ;
+		f = output == expected && cursor.done();
+
+		ys::KDRangeCursor<float, 3> all(tree, points.data(), from, to);
+		f = f && all.done() == (r == 2);
+	}
+
+	return f;
+}
+
 /**
  * サンプル・コマンド
+ * @return	全ての確認が正しければ0
  */
 int
 main()
@@ -42,5 +1365,45 @@ main()
 		}
 	}
 
-	return 0;
+	const struct {
+		const char* name;	// 確認の名前
+		bool (*check)();	// 確認
+	} checks[] = {
+		{"mapped image", CheckMappedImage},
+		{"point loader", CheckLoader},
+		{"external builder", CheckExternalBuilder},
+		{"paged array", CheckPagedArray},
+		{"dynamic array", CheckDynamicArray},
+		{"erase", CheckErase},
+		{"refit", CheckRefit},
+		{"search handle", CheckSearchHandle},
+		{"move and share", CheckMoveAndShare},
+		{"build buffer", CheckBuildBuffer},
+		{"arena", CheckArena},
+		{"numa replicas", CheckNumaReplicas},
+		{"huge pages", CheckHugePages},
+		{"owned", CheckOwned},
+		{"payloads", CheckPayloads},
+		{"aggregate", CheckAggregate},
+		{"categories", CheckCategories},
+		{"nearest", CheckNearest},
+		{"forest", CheckForest},
+		{"nearest iterator", CheckNearestIterator},
+		{"metrics", CheckMetrics},
+		{"periodic", CheckPeriodic},
+		{"self join", CheckSelfJoin},
+		{"join", CheckJoin},
+		{"all nearest", CheckAllNearest},
+		{"warm start", CheckWarmStart},
+		{"range cursor", CheckRangeCursor},
+	};
+
+	int status(0);
+	for (const auto& c : checks) {
+		bool f = c.check();
+		std::printf("check %-20s: %s\n", c.name, f ? "ok" : "NG");
+		if (!f) status = 1;
+	}
+
+	return status;
 }